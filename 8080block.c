@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include "8080emulator.h"
+#include "8080block.h"
+#include "8080memory.h"
+
+// Instruction length in bytes for each opcode
+static const uint8_t size8080[256] = {
+        1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, //0x00..0x0f
+        1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, //0x10..0x1f
+        1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+        1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, //0x40..0x4f
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, //0x80..0x8f
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+
+        1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, //0xc0..0xcf
+        1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1,
+        1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+        1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+};
+
+// Opcodes that end a block: anything that can change pc other than falling through,
+// HLT, and the instructions the caller has to see (IN/OUT, EI/DI for interrupts)
+static int EndsBlock(uint8_t op)
+{
+    if (op >= 0xc0)
+    {
+        switch (op & 0x07) {
+            case 0x00:  // Rcc
+            case 0x02:  // Jcc
+            case 0x04:  // Ccc
+            case 0x07:  // RST
+                return 1;
+            default:
+                break;
+        }
+        switch (op) {
+            case 0xc3:  // JMP
+            case 0xc9:  // RET
+            case 0xcd:  // CALL
+            case 0xd3:  // OUT
+            case 0xdb:  // IN
+            case 0xe9:  // PCHL
+            case 0xf3:  // DI
+            case 0xfb:  // EI
+                return 1;
+            default:
+                return 0;
+        }
+    }
+    return op == 0x76;  // HLT
+}
+
+BlockCache8080* NewBlockCache8080(void)
+{
+    return calloc(1, sizeof(BlockCache8080));
+}
+
+void FreeBlockCache8080(BlockCache8080* cache)
+{
+    for (int i = 0; i < 0x10000; i++)
+        free(cache->block[i]);
+    free(cache);
+}
+
+// Drops every block, for when memory changes wholesale (loading a snapshot)
+void FlushBlockCache8080(BlockCache8080* cache)
+{
+    for (int i = 0; i < 0x10000; i++)
+    {
+        free(cache->block[i]);
+        cache->block[i] = NULL;
+    }
+    memset(cache->heat, 0, sizeof(cache->heat));
+    memset(cache->code_page, 0, sizeof(cache->code_page));
+    cache->generation++;
+}
+
+Block8080* DecodeBlock8080(BlockCache8080* cache, const MemoryMap8080* map, uint16_t pc)
+{
+    Block8080* block = malloc(sizeof(Block8080));
+    block->start = pc;
+    block->count = 0;
+
+    uint16_t addr = pc;
+    while (block->count < BLOCK_MAX_INSNS)
+    {
+        uint8_t op = map->read[addr >> 8][addr & 0xff];
+        // IN/OUT and HLT are run by the caller, so stop in front of them
+        if ((op == 0xdb || op == 0xd3 || op == 0x76) && block->count > 0) break;
+
+        block->ops[block->count] = op;
+        block->pcs[block->count] = addr;
+        block->count++;
+        cache->code_page[addr >> 8] = 1;
+        cache->code_page[(uint16_t) (addr + size8080[op] - 1) >> 8] = 1;
+
+        addr += size8080[op];
+        if (EndsBlock(op)) break;
+    }
+
+    cache->block[pc] = block;
+    return block;
+}
+
+void InvalidateBlocks8080(BlockCache8080* cache, uint16_t address)
+{
+    // A block is shorter than a page, so only blocks starting in this page
+    // or the one before can cover the written address
+    uint16_t page = address >> 8;
+    uint16_t first = (uint16_t) (((page - 1) & 0xff) << 8);
+    for (int i = 0; i < 0x200; i++)
+    {
+        uint16_t start = (uint16_t) (first + i);
+        Block8080* block = cache->block[start];
+        if (block == NULL) continue;
+
+        uint16_t last = block->pcs[block->count - 1];
+        uint16_t end = last + size8080[block->ops[block->count - 1]];
+        if ((uint16_t) (address - start) < (uint16_t) (end - start))
+        {
+            free(block);
+            cache->block[start] = NULL;
+            cache->heat[start] = 0;
+            cache->generation++;
+        }
+    }
+}
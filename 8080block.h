@@ -0,0 +1,32 @@
+#ifndef INC_8080EMULATOR_8080BLOCK_H
+#define INC_8080EMULATOR_8080BLOCK_H
+
+#include <stdint.h>
+
+#define BLOCK_MAX_INSNS 32      // longest straight-line run decoded into one block
+#define BLOCK_HOT_COUNT 16      // visits to a pc before a block is decoded there
+
+// A basic block decoded once from memory: opcodes and addresses of each instruction,
+// ending at the first branch/call/return, IN/OUT, EI/DI or HLT.
+typedef struct Block8080 {
+    uint16_t    start;
+    uint8_t     count;
+    uint8_t     ops[BLOCK_MAX_INSNS];
+    uint16_t    pcs[BLOCK_MAX_INSNS];
+} Block8080;
+
+typedef struct BlockCache8080 {
+    uint8_t     code_page[256];             // set for every 256 byte page a block was decoded from
+    uint32_t    generation;                 // bumped whenever blocks get invalidated
+    Block8080*  block[0x10000];             // block starting at each address, or NULL
+    uint8_t     heat[0x10000];
+} BlockCache8080;
+
+BlockCache8080* NewBlockCache8080(void);
+void FreeBlockCache8080(BlockCache8080* cache);
+void FlushBlockCache8080(BlockCache8080* cache);
+struct MemoryMap8080;
+Block8080* DecodeBlock8080(BlockCache8080* cache, const struct MemoryMap8080* map, uint16_t pc);
+void InvalidateBlocks8080(BlockCache8080* cache, uint16_t address);
+
+#endif //INC_8080EMULATOR_8080BLOCK_H
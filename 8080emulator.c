@@ -1,1364 +1,879 @@
-#include <stdio.h>
 #include <stdlib.h>
 #include "8080emulator.h"
+#include "8080block.h"
+#include "8080lanes.h"
+#include "8080memory.h"
+#include "profiler.h"
 
+// Loads and stores go through the page table in state->map. Plain RAM is a direct
+// store; other pages call their handler, or drop the write (ROM). An attached block
+// cache drops blocks whose code was just overwritten.
+#define READ_MEM(state, address) \
+        ((state)->map->read[(uint16_t) (address) >> 8][(uint16_t) (address) & 0xff])
 
+#define WRITE_MEM(state, address, value) do { \
+        uint16_t write_address = (address); \
+        uint8_t* write_page = (state)->map->write[write_address >> 8]; \
+        if (write_page) write_page[write_address & 0xff] = (value); \
+        else if ((state)->map->write_handler[write_address >> 8]) \
+            (state)->map->write_handler[write_address >> 8]((state), write_address, (value)); \
+        if ((state)->blocks && (state)->blocks->code_page[write_address >> 8]) \
+            InvalidateBlocks8080((state)->blocks, write_address); \
+    } while (0)
 
-void SetFlags(ConditionCodes* cc, uint16_t answer);
-void SetFlagsNoCarry(ConditionCodes* cc, uint16_t answer);
-void CallAdr(State8080* state, const unsigned char *opcode);
-void CallConstantAdr(State8080* state, uint8_t adr);
-void Return(State8080* state);
-void SBB_Register(uint8_t register_val, State8080* state);
+// The instruction at address, read in place unless its operand bytes could run
+// into the next page, which may be mapped somewhere else entirely
+#define FETCH(state, address) \
+        (((address) & 0xff) < 0xfe \
+            ? &(state)->map->read[(uint16_t) (address) >> 8][(uint16_t) (address) & 0xff] \
+            : FetchAcrossPages((state), (address)))
 
-void UnimplementedInstruction(State8080* state)
-{
-    //pc will have advanced one, so undo that
-    printf ("Error: Unimplemented instruction\n");
-    exit(1);
-}
-
-int Emulate8080Op(State8080* state)
-{
-    unsigned char *opcode = &state->memory[state->pc];
-
-    // default inc pc
-    // do this BEFORE processing
-    // some operations will set pc, so pc shouldn't get changed after that
-    state->pc+=1;
-
-    switch(*opcode) {
-        case 0x00:  // NOP
-            break;
-        case 0x01:  // LXI B, D16   B <- byte 3, C <- byte 2
-            state->c = opcode[1];
-            state->b = opcode[2];
-            state->pc += 2;
-            break;
-        case 0x02:  // STAX B   (BC) <- A
-        {
-            uint16_t address = (state->b << 8) | state->c;
-            state->memory[address] = state->a;
-        }
-            break;
-        case 0x03:  // INX  	BC <- BC+1
-            state->c++;
-            if (state->c == 0) state->b++;
-            break;
-        case 0x04:  // INR B	B <- B+1
-            state->b++;
-            SetFlagsNoCarry(&state->cc, state->b);
-            break;
-        case 0x05:  // DCR B    B <- B-1
-            state->b--;
-            SetFlagsNoCarry(&state->cc, state->b);
-            break;
-        case 0x06:  // MVI B, D8    B <- byte2
-            state->b = opcode[1];
-            state->pc++;
-            break;
-        case 0x07:  // RLC  	A = A << 1; bit 0 = prev bit 7; CY = prev bit 7
-        {
-            uint8_t a = state->a;
-            // bit 7 wraps around to bit 0, everything else goes left
-            state->a = ((a & 0x80) >> 7) | (a << 1);
-            state->cc.cy = state->a & 1;
-        }
-            break;
-        case 0x08:  // NOP
-            break;
-        case 0x09:  // DAD B    HL = HL + BC
-        {
-            uint32_t hl = (state->h<<8) | (state->l);
-            uint16_t bc = (state->b<<8) | (state->c);
-            hl += bc;
-            state->h = (hl>>8) & 0xff;
-            state->l = hl & 0xff;
-            state->cc.cy = (hl > 0xffff);   // only set carry
-        }
-            break;
-        case 0x0a:  // LDAX B   A <- (BC)
-        {
-            uint16_t address = (state->b << 8) | state->c;
-            state->a = state->memory[address];
-        }
-            break;
-        case 0x0b:  // DCX  	BC <- BC-1
-            if (state->c == 0) state->b--;
-            state->c--;
-            break;
-        case 0x0c:  // INR C	C <- C+1
-            state->c++;
-            SetFlagsNoCarry(&state->cc, state->c);
-            break;
-        case 0x0d:  // DCR C    C <- C-1
-            state->c--;
-            SetFlagsNoCarry(&state->cc, state->c);
-            break;
-        case 0x0e:  // MVI C, D8    C <- byte 2
-            state->c = opcode[1];
-            state->pc++;
-            break;
-        case 0x0f:  // RRC      A = A >> 1; bit 7 = prev bit 0; CY = prev bit 0
-        {
-            uint8_t a = state->a;
-            // bit 0 wraps around to bit 7, everything else goes right
-            state->a = ((a & 1) << 7) | (a >> 1);
-            state->cc.cy = a & 1;
-        }
-            break;
-        case 0x10:  // NOP
-            break;
-        case 0x11:  // LXI D, D16   D <- byte 3, E <- byte 2
-            state->e = opcode[1];
-            state->d = opcode[2];
-            state->pc += 2;
-            break;
-        case 0x12:  // STAX D   (DE) <- A
-        {
-            uint16_t address = (state->d << 8) | state->e;
-            state->memory[address] = state->a;
-        }
-            break;
-        case 0x13:  // INX D 	DE <- DE+1
-            state->e++;
-            if (state->e == 0) state->d++;
-            break;
-        case 0x14:  // INR D	D <- D+1
-            state->d++;
-            SetFlagsNoCarry(&state->cc, state->d);
-            break;
-        case 0x15:  // DCR D    D <- D-1
-            state->d--;
-            SetFlagsNoCarry(&state->cc, state->d);
-            break;
-        case 0x16:  // MVI D, D8    D <- byte2
-            state->d = opcode[1];
-            state->pc++;
-            break;
-        case 0x17:  // RAL  	A = A << 1; bit 0 = prev CY; CY = prev bit 7
-        {
-            uint8_t a = state->a;
-            // bit 0 is prev carry, everything else goes left
-            state->a = ((state->cc.cy) >> 7) | (a << 1);
-            state->cc.cy = (a & 0x80) == 0x80;
-        }
-            break;
-        case 0x18:  // NOP
-            break;
-        case 0x19:  // DAD B    HL = HL + DE
-        {
-            uint32_t hl = (state->h<<8) | (state->l);
-            uint16_t de = (state->d<<8) | (state->e);
-            hl += de;
-            state->h = (hl>>8) & 0xff;
-            state->l = hl & 0xff;
-            state->cc.cy = (hl > 0xffff);   // only set carry
-        }
-            break;
-        case 0x1a:  // LDAX D   A <- (DE)
-        {
-            uint16_t address = (state->d << 8) | state->e;
-            state->a = state->memory[address];
-        }
-            break;
-        case 0x1b:  // DCX D 	DE <- DE-1
-            if (state->e == 0) state->d--;
-            state->e--;
-            break;
-        case 0x1c:  // INR E	E <- E+1
-            state->e++;
-            SetFlagsNoCarry(&state->cc, state->e);
-            break;
-        case 0x1d:  // DCR E    E <- E-1
-            state->e--;
-            SetFlagsNoCarry(&state->cc, state->e);
-            break;
-        case 0x1e:  // MVI E, D8    E <- byte2
-            state->e = opcode[1];
-            state->pc++;
-            break;
-        case 0x1f:  // RAR      A = A >> 1; bit 7 = prev cy; CY = prev bit 0
-        {
-            uint8_t a = state->a;
-            state->a = (state->cc.cy << 7) | (a >> 1);
-            state->cc.cy = a & 1;
-        }
-            break;
-        case 0x20:  // NOP
-            break;
-        case 0x21:  // LXI H, D16   H <- byte 3, L <- byte 2
-            state->l = opcode[1];
-            state->h = opcode[2];
-            state->pc += 2;
-            break;
-        case 0x22:  // 	SHLD adr    (adr) <-L; (adr+1)<-H
-        {
-            uint16_t address = (opcode[2] << 8) | opcode[1];
-            state->memory[address] = state->l;
-            state->memory[address + 1] = state->h;
-            state->pc += 2;
-        }
-            break;
-        case 0x23:  // INX H 	HL <- HL+1
-            state->l++;
-            if (state->l == 0) state->h++;
-            break;
-        case 0x24:  // INR H	H <- H+1
-            state->h++;
-            SetFlagsNoCarry(&state->cc, state->h);
-            break;
-        case 0x25:  // DCR H    H <- H-1
-            state->h--;
-            SetFlagsNoCarry(&state->cc, state->h);
-            break;
-        case 0x26:  // MVI H, D8    H <- byte2
-            state->h = opcode[1];
-            state->pc++;
-            break;
-        case 0x27:  // DAA special
-            if ((state->a & 0xf) > 9)
-                state->a += 6;
-            if ((state->a & 0xf0) > 0x90)
-            {
-                uint16_t answer = (uint16_t) state->a + 0x60;
-                state->a = answer & 0xff;
-                SetFlags(&state->cc, answer);
-            }
-            break;
-        case 0x28:  // NOP
-            break;
-        case 0x29:  // DAD H    HL = HL + HL?
-        {
-            uint32_t hl = (state->h<<8) | (state->l);
-            hl += hl;
-            state->h = (hl>>8) & 0xff;
-            state->l = hl & 0xff;
-            state->cc.cy = (hl > 0xffff);   // only set carry
-        }
-            break;
-        case 0x2a:  // LHLD adr L <- (adr); H <- (adr + 1)
-        {
-            uint16_t address = (opcode[2] << 8) | opcode[1];
-            state->l = state->memory[address];
-            state->h = state->memory[address + 1];
-            state->pc += 2;
-        }
-            break;
-        case 0x2b:  // DCX H    HL = HL - 1
-        {
-            if (state->l == 0) state->h--;
-            state->l--;
-        }
-            break;
-        case 0x2c:  // INR L	L <- L+1
-            state->l++;
-            SetFlagsNoCarry(&state->cc, state->l);
-            break;
-        case 0x2d:  // DCR L    L <- L-1
-            state->l--;
-            SetFlagsNoCarry(&state->cc, state->l);
-            break;
-        case 0x2e:  // MVI L, D8    L <- byte2
-            state->l = opcode[1];
-            state->pc++;
-            break;
-        case 0x2f:  // CMA  not  (A<-!A)
-            state->a = ~state->a;
-            break;
-        case 0x30:  // NOP
-            break;
-        case 0x31:  // LXI SP, D16  SP.hi <- byte 3, SP.lo <- byte 2
-        {
-            uint16_t address = (opcode[2] << 8) | opcode[1];
-            state->sp = address;
-            state->pc += 2;
-        }
-            break;
-        case 0x32:  // STA adr  (adr) <- A
-        {
-
-            uint16_t address = (opcode[2] << 8) | opcode[1];
-            state->memory[address] = state->a;
-            state->pc += 2;
-        }
-            break;
-        case 0x33:  // INX SP   SP = SP + 1
-            state->sp++;
-            break;
-        case 0x34:  // INR M    (HL) <- (HL) + 1
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] += 1;
-            SetFlagsNoCarry(&state->cc, state->memory[address]);
-        }
-            break;
-        case 0x35:  // DCR M    (HL) <- (HL) - 1
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] -= 1;
-            SetFlagsNoCarry(&state->cc, state->memory[address]);
-        }
-            break;
-        case 0x36:  // MVI M, D8    (HL) <- byte2
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] = opcode[1];
-            state->pc++;
-        }
-            break;
-        case 0x37:  // STC      CY = 1
-            state->cc.cy = 1;
-            break;
-        case 0x38:  // NOP
-            break;
-        case 0x39:  // DAD SP   HL = HL + SP
-        {
-            uint32_t hl = (state->h << 8) | (state->l);
-            hl += state->sp;
-            state->h = (hl >> 8) & 0xff;
-            state->l = hl & 0xff;
-            state->cc.cy = (hl > 0xffff);   // only set carry
-        }
-            break;
-        case 0x3a:  // LDA adr  A <- (adr)
-        {
-
-            uint16_t address = (opcode[2] << 8) | opcode[1];
-            state->a = state->memory[address];
-            state->pc += 2;
-        }
-            break;
-        case 0x3b:  // DCX SP   SP = SP - 1
-            state->sp--;
-            break;
-        case 0x3c:  // INR A	A <- A+1
-            state->a++;
-            SetFlagsNoCarry(&state->cc, state->a);
-            break;
-        case 0x3d:  // DCR A    A <- A-1
-            state->a--;
-            SetFlagsNoCarry(&state->cc, state->a);
-            break;
-        case 0x3e:  // MVI A, D8    A <- byte2
-            state->a = opcode[1];
-            state->pc++;
-            break;
-        case 0x3f:  // CMC  not  (CY<-!CY)
-            state->cc.cy = ~state->cc.cy;
-            break;
-        case 0x40:  // MOV B, B     B <- B
-            state->b = state->b;
-            break;
-        case 0x41:  // MOV B, C
-            state->b = state->c;
-            break;
-        case 0x42:  // MOV B, D
-            state->b = state->d;
-            break;
-        case 0x43:  // MOV B, E
-            state->b = state->e;
-            break;
-        case 0x44:  // MOV B, H
-            state->b = state->h;
-            break;
-        case 0x45:  // MOV B, L
-            state->b = state->l;
-            break;
-        case 0x46:  // MOV B, M     B <- (HL)
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->b = state->memory[address];
-        }
-            break;
-        case 0x47:  // MOV B, A
-            state->b = state->a;
-            break;
-        case 0x48:  // MOV C, B     C <- B
-            state->c = state->b;
-            break;
-        case 0x49:  // MOV C, C
-            state->c = state->c;
-            break;
-        case 0x4a:  // MOV C, D
-            state->c = state->d;
-            break;
-        case 0x4b:  // MOV C, E
-            state->c = state->e;
-            break;
-        case 0x4c:  // MOV C, H
-            state->c = state->h;
-            break;
-        case 0x4d:  // MOV C, L
-            state->c = state->l;
-            break;
-        case 0x4e:  // MOV C, M     C <- (HL)
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->c = state->memory[address];
-        }
-            break;
-        case 0x4f:  // MOV C, A
-            state->c = state->a;
-            break;
-        case 0x50:  // MOV D, B
-            state->d = state->b;
-            break;
-        case 0x51:  // MOV D, C
-            state->d = state->c;
-            break;
-        case 0x52:  // MOV D, D
-            state->d = state->d;
-            break;
-        case 0x53:  // MOV D, E
-            state->d = state->e;
-            break;
-        case 0x54:  // MOV D, H
-            state->d = state->h;
-            break;
-        case 0x55:  // MOV D, L
-            state->d = state->l;
-            break;
-        case 0x56:  // MOV D, M
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->d = state->memory[address];
-        }
-            break;
-        case 0x57:  // MOV D, A
-            state->d = state->a;
-            break;
-        case 0x58:  // MOV E, B
-            state->e = state->b;
-            break;
-        case 0x59:  // MOV E, C
-            state->e = state->c;
-            break;
-        case 0x5a:  // MOV E, D
-            state->e = state->d;
-            break;
-        case 0x5b:  // MOV E, E
-            state->e = state->e;
-            break;
-        case 0x5c:  // MOV E, H
-            state->e = state->h;
-            break;
-        case 0x5d:  // MOV E, L
-            state->e = state->l;
-            break;
-        case 0x5e:  // MOV E, M
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->e = state->memory[address];
-        }
-            break;
-        case 0x5f:  // MOV E, A
-            state->e = state->a;
-            break;
-        case 0x60:  // MOV H, B
-            state->h = state->b;
-            break;
-        case 0x61:  // MOV H, C
-            state->h = state->c;
-            break;
-        case 0x62:  // MOV H, D
-            state->h = state->d;
-            break;
-        case 0x63:  // MOV H, E
-            state->h = state->e;
-            break;
-        case 0x64:  // MOV H, H
-            state->h = state->h;
-            break;
-        case 0x65:  // MOV H, L
-            state->h = state->l;
-            break;
-        case 0x66:  // MOV H, M
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->h = state->memory[address];
-        }
-            break;
-        case 0x67:  // MOV H, A
-            state->h = state->a;
-            break;
-        case 0x68:  // MOV L, B
-            state->l = state->b;
-            break;
-        case 0x69:  // MOV L, C
-            state->l = state->c;
-            break;
-        case 0x6a:  // MOV L, D
-            state->l = state->d;
-            break;
-        case 0x6b:  // MOV L, E
-            state->l = state->e;
-            break;
-        case 0x6c:  // MOV L, H
-            state->l = state->h;
-            break;
-        case 0x6d:  // MOV L, L
-            state->l = state->l;
-            break;
-        case 0x6e:  // MOV L, M
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->l = state->memory[address];
-        }
-            break;
-        case 0x6f:  // MOV L, A
-            state->l = state->a;
-            break;
-        case 0x70:  // MOV M, B
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] = state->b;
-            break;
-        }
-        case 0x71:  // MOV M, C
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] = state->c;
-            break;
-        }
-        case 0x72:  // MOV M, D
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] = state->d;
-            break;
-        }
-        case 0x73:  // MOV M, E
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] = state->e;
-            break;
-        }
-        case 0x74:  // MOV M, H
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] = state->h;
-            break;
-        }
-        case 0x75:  // MOV M, L
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] = state->l;
-            break;
-        }
-        case 0x76:  // HLT special
-            exit(0);
-        case 0x77:  // MOV M, A
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->memory[address] = state->a;
-        }
-            break;
-        case 0x78:  // MOV A, B     A <- B
-            state->a = state->b;
-            break;
-        case 0x79:  // MOV A, C
-            state->a = state->c;
-            break;
-        case 0x7a:  // MOV A, D
-            state->a = state->d;
-            break;
-        case 0x7b:  // MOV A, E
-            state->a = state->e;
-            break;
-        case 0x7c:  // MOV A, H
-            state->a = state->h;
-            break;
-        case 0x7d:  // MOV A, L
-            state->a = state->l;
-            break;
-        case 0x7e:  // MOV A, M     A <- (HL)
-        {
-            uint16_t address = (state->h << 8) | (state->l);
-            state->a = state->memory[address];
-        }
-            break;
-        case 0x7f:  // MOV A, A
-            state->a = state->a;
-            break;
-        case 0x80:  // ADD B
-        {
-            // store result in 16 bit answer to check for carry
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->b;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;   // remove extra 8 bits
-        }
-            break;
-        case 0x81:  // ADD C
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->c;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x82:  // ADD D
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->d;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x83:  // ADD E
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->e;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x84:  // ADD H
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->h;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x85:  // ADD L
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->l;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x86:  // ADD M
-        {
-            // M is the byte pointed to by address stored in HL
-            uint16_t address = (state->h<<8) | (state->l);  // concat h and l
-            uint16_t answer = (uint16_t) state->a + state->memory[address];
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x87:  // ADD A
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->a;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x88:  // 	ADC B
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->b + state->cc.cy;;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x89:   // ADC C
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->c + state->cc.cy;;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x8a:   // ADC D
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->d + state->cc.cy;;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x8b:  // ADC E
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->e + state->cc.cy;;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x8c:  // ADC H
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->h + state->cc.cy;;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x8d:  // ADC L
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->l + state->cc.cy;;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x8e:  // ADC M
-        {
-            uint16_t address = (state->h<<8) | (state->l);  // concat h and l
-            uint16_t answer = (uint16_t) state->a + state->memory[address] + state->cc.cy;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x8f:  // ADC A
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) state->a + state->cc.cy;;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-        }
-            break;
-        case 0x90:  // SUB B
-        {
-            state->cc.cy = state->a < state->b;
-            state->a  -= state->b;
-            SetFlagsNoCarry(&state->cc, state->a);
-        }
-            break;
-        case 0x91:  // SUB C
-        {
-            state->cc.cy = state->a < state->c;
-            state->a  -= state->c;
-            SetFlagsNoCarry(&state->cc, state->a);
-        }
-            break;
-        case 0x92:  // SUB D
-        {
-            state->cc.cy = state->a < state->d;
-            state->a  -= state->d;
-            SetFlagsNoCarry(&state->cc, state->a);
-        }
-            break;
-        case 0x93:  // SUB E
-        {
-            state->cc.cy = state->a < state->e;
-            state->a  -= state->e;
-            SetFlagsNoCarry(&state->cc, state->a);
-        }
-            break;
-        case 0x94:  // SUB H
-        {
-            state->cc.cy = state->a < state->h;
-            state->a  -= state->h;
-            SetFlagsNoCarry(&state->cc, state->a);
-        }
-            break;
-        case 0x95:  // SUB L
-        {
-            state->cc.cy = state->a < state->l;
-            state->a  -= state->l;
-            SetFlagsNoCarry(&state->cc, state->a);
-        }
-            break;
-        case 0x96:  // SUB M
-        {
-            // M is the byte pointed to by SUBress stored in HL
-            uint16_t address = (state->h<<8) | (state->l);  // concat h and l
-            state->cc.cy = state->a < state->memory[address];
-            state->a  -= state->memory[address];
-            SetFlagsNoCarry(&state->cc, state->a);
-        }
-            break;
-        case 0x97:  // SUB A
-        {
-            state->cc.cy = 0;
-            state->a  -= state->a;
-            SetFlagsNoCarry(&state->cc, state->a);
-        }
-            break;
-        case 0x98:  // SBB B
-            SBB_Register(state->b, state);
-            break;
-        case 0x99:  // SBB C
-            SBB_Register(state->c, state);
-            break;
-        case 0x9a:  // SBB D
-            SBB_Register(state->d, state);
-            break;
-        case 0x9b:  // SBB E
-            SBB_Register(state->e, state);
-            break;
-        case 0x9c:  // SBB H
-            SBB_Register(state->h, state);
-            break;
-        case 0x9d:  // SBB L
-            SBB_Register(state->l, state);
-            break;
-        case 0x9e:  // SBB M
-        {
-            uint16_t address = (state->h << 8) | state->l;  // Memory address
-            SBB_Register(state->memory[address], state);
-        }
-            break;
-        case 0x9f:  // SBB A
-            SBB_Register(state->a, state);
-            break;
-        case 0xa0:  // ANA B   (A <-A & B)
-            state->a &= state->b;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;   // AND always clears CY
-            break;
-        case 0xa1:  // ANA C   (A <-A & C)
-            state->a &= state->c;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xa2:  // ANA D   (A <-A & D)
-            state->a &= state->d;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xa3:  // ANA E   (A <-A & E)
-            state->a &= state->e;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xa4:  // ANA H   (A <-A & H)
-            state->a &= state->h;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xa5:  // ANA L   (A <-A & L)
-            state->a &= state->l;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xa6:  // ANA M   (A <-A & (HL))
-        {
-            uint16_t address = (state->h << 8) | (state->l);  // concat h and l
-            state->a &= state->memory[address];
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-        }
-            break;
-        case 0xa7:  // ANA A   (A <-A & A)
-            // Don't need to update A because A & A doesn't change A
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xa8:  // XRA B   (A <-A ^ B)
-            state->a ^= state->b;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;   // AND always clears CY
-            break;
-        case 0xa9:  // XRA C   (A <-A ^ C)
-            state->a ^= state->c;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xaa:  // XRA D   (A <-A ^ D)
-            state->a ^= state->d;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xab:  // XRA E   (A <-A ^ E)
-            state->a ^= state->e;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xac:  // XRA H   (A <-A ^ H)
-            state->a ^= state->h;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xad:  // XRA L   (A <-A ^ L)
-            state->a ^= state->l;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xae:  // XRA M   (A <-A ^ (HL))
-        {
-            uint16_t address = (state->h << 8) | (state->l);  // concat h and l
-            state->a ^= state->memory[address];
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-        }
-            break;
-        case 0xaf:  // XRA A   (A <-A ^ A)
-            state->a = 0;   // xor itself is always 0
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xb0:  // ORA B   (A <-A | B)
-            state->a |= state->b;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;   // AND always clears CY
-            break;
-        case 0xb1:  // ORA C   (A <-A | C)
-            state->a |= state->c;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xb2:  // ORA D   (A <-A | D)
-            state->a |= state->d;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xb3:  // ORA E   (A <-A | E)
-            state->a |= state->e;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xb4:  // ORA H   (A <-A | H)
-            state->a |= state->h;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xb5:  // ORA L   (A <-A | L)
-            state->a |= state->l;
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xb6:  // ORA M   (A <-A | (HL))
-        {
-            uint16_t address = (state->h << 8) | (state->l);  // concat h and l
-            state->a |= state->memory[address];
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-        }
-            break;
-        case 0xb7:  // ORA A   (A <-A | A)
-            // Don't need to update A because A | A doesn't change A
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            break;
-        case 0xb8:  // CMP B    (A - B)
-        {
-            SetFlagsNoCarry(&state->cc, state->a - state->b);
-            state->cc.cy = state->a < state->b;
-        }
-            break;
-        case 0xb9:  // CMP C    (A - C)
-        {
-            SetFlagsNoCarry(&state->cc, state->a - state->c);
-            state->cc.cy = state->a < state->c;
-        }
-            break;
-        case 0xba:  // CMP D    (A - D)
-        {
-            SetFlagsNoCarry(&state->cc, state->a - state->d);
-            state->cc.cy = state->a < state->d;
-        }
-            break;
-        case 0xbb:  // CMP E    (A - E)
-        {
-            SetFlagsNoCarry(&state->cc, state->a - state->e);
-            state->cc.cy = state->a < state->e;
-        }
-            break;
-        case 0xbc:  // CMP H    (A - H)
-        {
-            SetFlagsNoCarry(&state->cc, state->a - state->h);
-            state->cc.cy = state->a < state->h;
-        }
-            break;
-        case 0xbd:  // CMP L    (A - L)
-        {
-            SetFlagsNoCarry(&state->cc, state->a - state->l);
-            state->cc.cy = state->a < state->l;
+#ifdef LAZY_FLAGS
+// ALU ops only record their result; Z/S/P get worked out when something reads them
+#define MATERIALIZE_ZSP(state) do { \
+        if ((state)->cc.lazy_pending) MaterializeZSP(&(state)->cc); \
+    } while (0)
+#else
+#define MATERIALIZE_ZSP(state) do { (void) (state); } while (0)
+#endif
+
+#ifdef PROFILE
+// Count the instruction that just ran at pc, once its cycle count is final
+#define PROFILE_OP(state, pc, op, op_cycles) do { \
+        if ((state)->profile) ProfileOp8080((state)->profile, (pc), (op), (op_cycles)); \
+    } while (0)
+#else
+#define PROFILE_OP(state, pc, op, op_cycles) do { } while (0)
+#endif
+
+#if defined(__GNUC__)
+// Label addresses for computed-goto dispatch, one per opcode, in opcode order.
+// LABEL(n) gives the address for opcode n, usually OP_LABEL.
+#define OP_LABEL(n)     &&op_##n
+#define OPCODE_LABELS(LABEL) \
+        LABEL(0x00), LABEL(0x01), LABEL(0x02), LABEL(0x03), LABEL(0x04), LABEL(0x05), LABEL(0x06), LABEL(0x07), \
+        LABEL(0x08), LABEL(0x09), LABEL(0x0a), LABEL(0x0b), LABEL(0x0c), LABEL(0x0d), LABEL(0x0e), LABEL(0x0f), \
+        LABEL(0x10), LABEL(0x11), LABEL(0x12), LABEL(0x13), LABEL(0x14), LABEL(0x15), LABEL(0x16), LABEL(0x17), \
+        LABEL(0x18), LABEL(0x19), LABEL(0x1a), LABEL(0x1b), LABEL(0x1c), LABEL(0x1d), LABEL(0x1e), LABEL(0x1f), \
+        LABEL(0x20), LABEL(0x21), LABEL(0x22), LABEL(0x23), LABEL(0x24), LABEL(0x25), LABEL(0x26), LABEL(0x27), \
+        LABEL(0x28), LABEL(0x29), LABEL(0x2a), LABEL(0x2b), LABEL(0x2c), LABEL(0x2d), LABEL(0x2e), LABEL(0x2f), \
+        LABEL(0x30), LABEL(0x31), LABEL(0x32), LABEL(0x33), LABEL(0x34), LABEL(0x35), LABEL(0x36), LABEL(0x37), \
+        LABEL(0x38), LABEL(0x39), LABEL(0x3a), LABEL(0x3b), LABEL(0x3c), LABEL(0x3d), LABEL(0x3e), LABEL(0x3f), \
+        LABEL(0x40), LABEL(0x41), LABEL(0x42), LABEL(0x43), LABEL(0x44), LABEL(0x45), LABEL(0x46), LABEL(0x47), \
+        LABEL(0x48), LABEL(0x49), LABEL(0x4a), LABEL(0x4b), LABEL(0x4c), LABEL(0x4d), LABEL(0x4e), LABEL(0x4f), \
+        LABEL(0x50), LABEL(0x51), LABEL(0x52), LABEL(0x53), LABEL(0x54), LABEL(0x55), LABEL(0x56), LABEL(0x57), \
+        LABEL(0x58), LABEL(0x59), LABEL(0x5a), LABEL(0x5b), LABEL(0x5c), LABEL(0x5d), LABEL(0x5e), LABEL(0x5f), \
+        LABEL(0x60), LABEL(0x61), LABEL(0x62), LABEL(0x63), LABEL(0x64), LABEL(0x65), LABEL(0x66), LABEL(0x67), \
+        LABEL(0x68), LABEL(0x69), LABEL(0x6a), LABEL(0x6b), LABEL(0x6c), LABEL(0x6d), LABEL(0x6e), LABEL(0x6f), \
+        LABEL(0x70), LABEL(0x71), LABEL(0x72), LABEL(0x73), LABEL(0x74), LABEL(0x75), LABEL(0x76), LABEL(0x77), \
+        LABEL(0x78), LABEL(0x79), LABEL(0x7a), LABEL(0x7b), LABEL(0x7c), LABEL(0x7d), LABEL(0x7e), LABEL(0x7f), \
+        LABEL(0x80), LABEL(0x81), LABEL(0x82), LABEL(0x83), LABEL(0x84), LABEL(0x85), LABEL(0x86), LABEL(0x87), \
+        LABEL(0x88), LABEL(0x89), LABEL(0x8a), LABEL(0x8b), LABEL(0x8c), LABEL(0x8d), LABEL(0x8e), LABEL(0x8f), \
+        LABEL(0x90), LABEL(0x91), LABEL(0x92), LABEL(0x93), LABEL(0x94), LABEL(0x95), LABEL(0x96), LABEL(0x97), \
+        LABEL(0x98), LABEL(0x99), LABEL(0x9a), LABEL(0x9b), LABEL(0x9c), LABEL(0x9d), LABEL(0x9e), LABEL(0x9f), \
+        LABEL(0xa0), LABEL(0xa1), LABEL(0xa2), LABEL(0xa3), LABEL(0xa4), LABEL(0xa5), LABEL(0xa6), LABEL(0xa7), \
+        LABEL(0xa8), LABEL(0xa9), LABEL(0xaa), LABEL(0xab), LABEL(0xac), LABEL(0xad), LABEL(0xae), LABEL(0xaf), \
+        LABEL(0xb0), LABEL(0xb1), LABEL(0xb2), LABEL(0xb3), LABEL(0xb4), LABEL(0xb5), LABEL(0xb6), LABEL(0xb7), \
+        LABEL(0xb8), LABEL(0xb9), LABEL(0xba), LABEL(0xbb), LABEL(0xbc), LABEL(0xbd), LABEL(0xbe), LABEL(0xbf), \
+        LABEL(0xc0), LABEL(0xc1), LABEL(0xc2), LABEL(0xc3), LABEL(0xc4), LABEL(0xc5), LABEL(0xc6), LABEL(0xc7), \
+        LABEL(0xc8), LABEL(0xc9), LABEL(0xca), LABEL(0xcb), LABEL(0xcc), LABEL(0xcd), LABEL(0xce), LABEL(0xcf), \
+        LABEL(0xd0), LABEL(0xd1), LABEL(0xd2), LABEL(0xd3), LABEL(0xd4), LABEL(0xd5), LABEL(0xd6), LABEL(0xd7), \
+        LABEL(0xd8), LABEL(0xd9), LABEL(0xda), LABEL(0xdb), LABEL(0xdc), LABEL(0xdd), LABEL(0xde), LABEL(0xdf), \
+        LABEL(0xe0), LABEL(0xe1), LABEL(0xe2), LABEL(0xe3), LABEL(0xe4), LABEL(0xe5), LABEL(0xe6), LABEL(0xe7), \
+        LABEL(0xe8), LABEL(0xe9), LABEL(0xea), LABEL(0xeb), LABEL(0xec), LABEL(0xed), LABEL(0xee), LABEL(0xef), \
+        LABEL(0xf0), LABEL(0xf1), LABEL(0xf2), LABEL(0xf3), LABEL(0xf4), LABEL(0xf5), LABEL(0xf6), LABEL(0xf7), \
+        LABEL(0xf8), LABEL(0xf9), LABEL(0xfa), LABEL(0xfb), LABEL(0xfc), LABEL(0xfd), LABEL(0xfe), LABEL(0xff)
+#endif
+
+static void SetFlags(ConditionCodes* cc, uint16_t answer);
+static void SetFlagsNoCarry(ConditionCodes* cc, uint16_t answer);
+static void SetFlagsLogic(ConditionCodes* cc, uint8_t answer);
+#ifdef LAZY_FLAGS
+static void MaterializeZSP(ConditionCodes* cc);
+#endif
+static void CallAdr(State8080* state, const unsigned char *opcode);
+static void CallConstantAdr(State8080* state, uint8_t adr);
+static void Return(State8080* state);
+static void SBB_Register(uint8_t register_val, State8080* state);
+static unsigned char* FetchAcrossPages(State8080* state, uint16_t address);
+
+int Emulate8080Op(State8080* state)
+{
+#ifdef PROFILE
+    uint16_t op_pc = state->pc;
+#endif
+    unsigned char *opcode = FETCH(state, state->pc);
+    int cycles = cycles8080[*opcode];
+    state->instructions++;
+
+    // default inc pc
+    // do this BEFORE processing
+    // some operations will set pc, so pc shouldn't get changed after that
+    state->pc+=1;
+
+    switch(*opcode) {
+#define OPCODE(n) case n:
+#include "8080ops.h"
+#undef OPCODE
+    }
+    PROFILE_OP(state, op_pc, *opcode, cycles);
+    MATERIALIZE_ZSP(state);
+    return cycles;
+}
+
+int Emulate8080OpThreaded(State8080* state)
+{
+#if defined(__GNUC__)
+    // Computed-goto dispatch: jumps straight to the opcode's label, no range check
+    static void* const dispatch[256] = { OPCODE_LABELS(OP_LABEL) };
+#ifdef PROFILE
+    uint16_t op_pc = state->pc;
+#endif
+    unsigned char *opcode = FETCH(state, state->pc);
+    int cycles = cycles8080[*opcode];
+    state->instructions++;
+    state->pc+=1;
+
+    do {
+        goto *dispatch[*opcode];
+#define OPCODE(n) op_##n:
+#include "8080ops.h"
+#undef OPCODE
+    } while (0);
+    PROFILE_OP(state, op_pc, *opcode, cycles);
+    MATERIALIZE_ZSP(state);
+    return cycles;
+#else
+    // No computed goto on this compiler, use the switch core
+    return Emulate8080Op(state);
+#endif
+}
+
+#if defined(__GNUC__)
+// Run8080 sends the instructions it hands back to the caller to its own labels: opcode n
+// goes to the second item of RUN8080_EXIT_n where that is defined, to OP_LABEL otherwise
+#define RUN8080_EXIT_0x76   ~, &&run_hlt
+#define RUN8080_EXIT_0xd3   ~, &&run_out
+#define RUN8080_EXIT_0xdb   ~, &&run_in
+#define RUN8080_EXIT_0xfb   ~, &&run_ei
+#define SECOND_ITEM(first, second, ...) second
+#define PICK_SECOND(...)    SECOND_ITEM(__VA_ARGS__)
+#define RUN8080_LABEL(n)    PICK_SECOND(RUN8080_EXIT_##n, OP_LABEL(n), ~)
+#endif
+
+int Run8080(State8080* machine, int cycle_budget, Exit8080* reason)
+{
+    // Work on a local copy so the compiler can keep the registers out of memory
+    State8080 local = *machine;
+    State8080* state = &local;
+    unsigned char *opcode;
+    uint8_t op;
+    int cycles = 0;
+
+    while (cycles < cycle_budget)
+    {
+        opcode = FETCH(state, state->pc);
+        op = *opcode;   // the instruction may overwrite itself
+#ifdef PROFILE
+        uint16_t op_pc = state->pc;
+        int op_start = cycles;
+#endif
+        cycles += cycles8080[op];
+        state->instructions++;
+#if defined(__GNUC__)
+        static void* const dispatch[256] = { OPCODE_LABELS(RUN8080_LABEL) };
+        state->pc += 1;
+
+        do {
+            goto *dispatch[op];
+            // The bodies of the RUN8080_EXIT opcodes are never jumped to here
+#define OPCODE(n) op_##n: __attribute__((unused))
+#include "8080ops.h"
+#undef OPCODE
+        } while (0);
+#else
+        switch (op) {
+            case 0x76: state->pc += 1; goto run_hlt;
+            case 0xd3: state->pc += 1; goto run_out;
+            case 0xdb: state->pc += 1; goto run_in;
+            case 0xfb: state->pc += 1; goto run_ei;
+            default: break;
+        }
+        state->pc += 1;
+
+        switch (op) {
+#define OPCODE(n) case n:
+#include "8080ops.h"
+#undef OPCODE
         }
-            break;
-        case 0xbe:  // CMP M    (A - (HL))
+#endif
+        PROFILE_OP(state, op_pc, op, cycles - op_start);
+    }
+    *reason = EXIT_BUDGET;
+    goto done;
+
+    // Leave pc on IN/OUT/HLT so the caller can handle them
+run_in:
+    *reason = EXIT_IN;
+    goto unfetch;
+run_out:
+    *reason = EXIT_OUT;
+    goto unfetch;
+run_hlt:
+    *reason = EXIT_HLT;
+unfetch:
+    state->pc -= 1;
+    cycles -= cycles8080[op];
+    state->instructions--;
+    goto done;
+    // EI runs, then returns so the caller can deliver a pending interrupt
+run_ei:
+    state->int_enable = 1;
+    *reason = EXIT_EI;
+    PROFILE_OP(state, state->pc - 1, op, cycles8080[op]);
+
+done:
+    MATERIALIZE_ZSP(state);
+    *machine = local;
+    return cycles;
+}
+
+int Emulate8080Block(State8080* state, int cycle_budget)
+{
+    BlockCache8080* cache = state->blocks;
+    uint16_t pc = state->pc;
+    Block8080* block = cache->block[pc];
+    if (block == NULL)
+    {
+        if (cache->heat[pc] < BLOCK_HOT_COUNT)
         {
-            uint16_t address = (state->h << 8) | (state->l);  // concat h and l
-            SetFlagsNoCarry(&state->cc, state->a - state->memory[address]);
-            state->cc.cy = state->a < state->memory[address];
+            // Cold code runs on the interpreter until it has been seen often enough
+            cache->heat[pc]++;
+            return Emulate8080OpThreaded(state);
         }
-            break;
-        case 0xbf:  // CMP A    (A - A)
-            SetFlagsNoCarry(&state->cc, 0);    // A - A is always 0
-            state->cc.cy = 0;
-            break;
-        case 0xc0:  // RNZ adr  (if NZ, RET)
-            if (state->cc.z == 0)
-                Return(state);
-            break;
-        case 0xc1:  // POP B    C <- (sp); B <- (sp+1); sp <- sp+2
-        {
-            state->c = state->memory[state->sp];
-            state->b = state->memory[state->sp+1];
-            state->sp += 2;
+        block = DecodeBlock8080(cache, state->map, pc);
+    }
+
+    uint32_t generation = cache->generation;
+    int cycles = 0;
+    for (int i = 0; ; )
+    {
+        uint8_t op = block->ops[i];
+#if defined(__GNUC__) && defined(PROFILE)
+        // A store in the body can free the block, so nothing after it reads the block
+        uint16_t op_pc = block->pcs[i];
+        int op_start = cycles;
+#endif
+        cycles += cycles8080[op];
+#if defined(__GNUC__)
+        state->instructions++;
+        static void* const dispatch[256] = { OPCODE_LABELS(OP_LABEL) };
+        unsigned char *opcode = FETCH(state, block->pcs[i]);
+        state->pc = block->pcs[i] + 1;
+
+        do {
+            goto *dispatch[op];
+#define OPCODE(n) op_##n:
+#include "8080ops.h"
+#undef OPCODE
+        } while (0);
+        PROFILE_OP(state, op_pc, op, cycles - op_start);
+#else
+        state->pc = block->pcs[i];
+        cycles += Emulate8080Op(state) - cycles8080[op];
+#endif
+        // Stop if a store hit translated code, the block may be gone
+        if (cache->generation != generation || cycles >= cycle_budget || ++i == block->count) break;
+    }
+    MATERIALIZE_ZSP(state);
+    return cycles;
+}
+
+// Lane kernels: one pass over the lanes in use, results blended in where mask is 0xff,
+// so the loops have no branches and compile to SIMD. Same results as the opcode bodies.
+// The passes go LANE_CHUNK lanes at a time, a fixed trip count the compiler vectorizes
+// fully, over the chunks that hold lanes in use; the lanes past lanes->count in the last
+// chunk are never running, so their mask is 0. Every function that uses EACH_LANE copies
+// the chunk count into chunks first: byte stores to the lane arrays could alias the
+// field, and reloading it stops vectorization.
+#define LANE_CHUNK      8
+#define EACH_LANE(i)    for (int i##_chunk = 0; i##_chunk < chunks * LANE_CHUNK; i##_chunk += LANE_CHUNK) \
+                            for (int i = i##_chunk; i < i##_chunk + LANE_CHUNK; i++)
+
+static inline uint8_t Blend8(uint8_t mask, uint8_t value, uint8_t old)
+{
+    return (value & mask) | (old & ~mask);
+}
+
+static inline uint16_t Blend16(uint8_t mask, uint16_t value, uint16_t old)
+{
+    uint16_t wide = (uint16_t) -(mask & 1);
+    return (value & wide) | (old & ~wide);
+}
+
+// zsp_table worked out instead of looked up, a gather has no SIMD form for bytes
+static inline uint8_t LaneZSP(uint8_t value)
+{
+    uint8_t parity = value ^ (value >> 4);
+    parity ^= parity >> 2;
+    parity ^= parity >> 1;
+    return (uint8_t) ((value == 0) | ((value >> 7) << 1) | ((~parity & 1) << 2));
+}
+
+// The psw bit each condition of Jcc/Ccc/Rcc tests, by bits 5-4 of the opcode (NZ/Z, NC/C,
+// PO/PE, P/M); bit 3 of the opcode says whether it must be set
+static const uint8_t condition_shift[4] = { 0, 3, 2, 1 };
+
+// ADD ADC SUB SBB ANA XRA ORA CMP of A with x, in opcode order
+static void AluLanes(Lanes8080* lanes, int kind, const uint8_t* x, const uint8_t* mask)
+{
+    const int chunks = (lanes->count + LANE_CHUNK - 1) / LANE_CHUNK;
+    uint8_t* a = lanes->reg[7];
+    uint8_t* psw = lanes->psw;
+#define ALU_LANES(result, carry, store) \
+    EACH_LANE(i) { \
+        uint8_t cy = (psw[i] >> 3) & 1; \
+        uint8_t value = (uint8_t) (result); \
+        uint8_t new_cy = (uint8_t) (carry); \
+        (void) cy; \
+        if (store) a[i] = Blend8(mask[i], value, a[i]); \
+        psw[i] = Blend8(mask[i], (psw[i] & 0xf0) | LaneZSP(value) | (new_cy << 3), psw[i]); \
+    }
+    switch (kind) {
+        case 0: ALU_LANES(a[i] + x[i], (a[i] + x[i]) >> 8, 1); break;
+        case 1: ALU_LANES(a[i] + x[i] + cy, (a[i] + x[i] + cy) >> 8, 1); break;
+        case 2: ALU_LANES(a[i] - x[i], a[i] < x[i], 1); break;
+        case 3: ALU_LANES(a[i] - x[i] - cy, a[i] < x[i] + cy, 1); break;
+        case 4: ALU_LANES(a[i] & x[i], 0, 1); break;
+        case 5: ALU_LANES(a[i] ^ x[i], 0, 1); break;
+        case 6: ALU_LANES(a[i] | x[i], 0, 1); break;
+        default: ALU_LANES(a[i] - x[i], a[i] < x[i], 0); break;
+    }
+#undef ALU_LANES
+}
+
+// Runs op on the lanes in mask as SIMD passes, for the register-only instructions that
+// make up most of the code; returns 0 for anything else (memory, stack, I/O, rotates)
+static int RunLaneKernel(Lanes8080* lanes, uint8_t op, const unsigned char* opcode, uint16_t pc,
+                         const uint8_t* mask)
+{
+    const int chunks = (lanes->count + LANE_CHUNK - 1) / LANE_CHUNK;
+    uint8_t (*reg)[LANES_8080] = lanes->reg;
+    uint8_t* psw = lanes->psw;
+    int dst = (op >> 3) & 7;
+    int src = op & 7;
+    int pair = (op >> 4) & 3;   // BC DE HL SP
+    uint16_t next = pc + 1;
+    uint16_t address = (opcode[2] << 8) | opcode[1];    // only read where the op has one
+
+    if (op >= 0x40 && op < 0x80)            // MOV dst, src
+    {
+        if (dst == 6 || src == 6) return 0;
+        EACH_LANE(i) reg[dst][i] = Blend8(mask[i], reg[src][i], reg[dst][i]);
+    }
+    else if (op >= 0x80 && op < 0xc0)       // ALU A, src
+    {
+        if (src == 6) return 0;
+        AluLanes(lanes, dst, reg[src], mask);
+    }
+    else if ((op & 0xc7) == 0xc6)           // ALU A, d8
+    {
+        uint8_t immediate[LANES_8080];
+        EACH_LANE(i) immediate[i] = opcode[1];
+        AluLanes(lanes, dst, immediate, mask);
+        next = pc + 2;
+    }
+    else if ((op & 0xc7) == 0x04 || (op & 0xc7) == 0x05)   // INR / DCR dst
+    {
+        if (dst == 6) return 0;
+        uint8_t step = (op & 1) ? 0xff : 1;
+        EACH_LANE(i) {
+            uint8_t value = reg[dst][i] + step;
+            reg[dst][i] = Blend8(mask[i], value, reg[dst][i]);
+            psw[i] = Blend8(mask[i], (psw[i] & ~(PSW_Z | PSW_S | PSW_P)) | LaneZSP(value), psw[i]);
         }
-            break;
-        case 0xc2:  // JNZ adr  (if NZ, PC <- adr)
-            if (state->cc.z == 0)
-                    state->pc = (opcode[2] << 8) | opcode[1];
+    }
+    else if ((op & 0xc7) == 0x06)           // MVI dst, d8
+    {
+        if (dst == 6) return 0;
+        EACH_LANE(i) reg[dst][i] = Blend8(mask[i], opcode[1], reg[dst][i]);
+        next = pc + 2;
+    }
+    else if ((op & 0xcf) == 0x01 || (op & 0xc7) == 0x03 || (op & 0xcf) == 0x09)    // LXI INX DCX DAD
+    {
+        uint8_t* hi = reg[pair * 2];
+        uint8_t* lo = reg[pair * 2 + 1];
+        EACH_LANE(i) {
+            uint16_t value = pair == 3 ? lanes->sp[i] : (uint16_t) ((hi[i] << 8) | lo[i]);
+            if ((op & 0xcf) == 0x01) value = address;
+            else if ((op & 0xcf) == 0x03) value++;
+            else if ((op & 0xcf) == 0x0b) value--;
             else
-                state->pc += 2;
-            break;
-        case 0xc3:  // JMP adr  (PC <- adr)
-            state->pc = (opcode[2] << 8) | opcode[1];
-            break;
-        case 0xc4:  // CNZ adr  (if NZ, CALL adr)
-            if (state->cc.z == 0)
-                CallAdr(state, opcode);
+            {
+                uint32_t hl = (uint32_t) ((reg[4][i] << 8) | reg[5][i]) + value;
+                psw[i] = Blend8(mask[i], (psw[i] & ~PSW_CY) | ((hl >> 16) << 3), psw[i]);
+                reg[4][i] = Blend8(mask[i], hl >> 8, reg[4][i]);
+                reg[5][i] = Blend8(mask[i], hl, reg[5][i]);
+                continue;
+            }
+            if (pair == 3) lanes->sp[i] = Blend16(mask[i], value, lanes->sp[i]);
             else
-                state->pc += 2;
-            break;
-        case 0xc5:  // PUSH B    (sp-2)<-C; (sp-1)<-B; sp <- sp - 2
-        {
-            state->memory[state->sp-1] = state->b;
-            state->memory[state->sp-2] = state->c;
-            state->sp = state->sp - 2;
+            {
+                hi[i] = Blend8(mask[i], value >> 8, hi[i]);
+                lo[i] = Blend8(mask[i], value, lo[i]);
+            }
         }
-            break;
-        case 0xc6:  // ADI D8 (A <- A + byte)
-        {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) opcode[1];
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-            state->pc++;
+        if ((op & 0xcf) == 0x01) next = pc + 3;
+    }
+    else if ((op & 0xc7) == 0xc2 || op == 0xc3)    // Jcc / JMP
+    {
+        int shift = condition_shift[dst >> 1];
+        int want = dst & 1;
+        EACH_LANE(i) {
+            int taken = op == 0xc3 || ((psw[i] >> shift) & 1) == want;
+            lanes->pc[i] = Blend16(mask[i], taken ? address : (uint16_t) (pc + 3), lanes->pc[i]);
         }
+        return 1;
+    }
+    else switch (op) {
+        case 0x00: case 0x08: case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0xcb: case 0xd9: case 0xdd: case 0xed: case 0xfd:     // NOP
+            break;
+        case 0xeb:                              // XCHG
+            EACH_LANE(i) {
+                uint8_t h = reg[4][i], l = reg[5][i];
+                reg[4][i] = Blend8(mask[i], reg[2][i], h);
+                reg[5][i] = Blend8(mask[i], reg[3][i], l);
+                reg[2][i] = Blend8(mask[i], h, reg[2][i]);
+                reg[3][i] = Blend8(mask[i], l, reg[3][i]);
+            }
             break;
-        case 0xc7:  // RST 0    (CALL $0)
-            CallConstantAdr(state, 0);
-            break;
-        case 0xc8:  // RZ adr  (if Z, RET)
-            if (state->cc.z)
-                Return(state);
-            break;
-        case 0xc9:  // RET      (PC.lo <- (sp); PC.hi<-(sp+1); SP <- SP+2)
-            Return(state);
-            break;
-        case 0xca:  // JZ adr   (if Z, PC <- adr)
-            if (state->cc.z)
-                state->pc = (opcode[2] << 8) | opcode[1];
-            else
-                state->pc += 2;
-            break;
-        case 0xcb:  // NOP
+        case 0x2f:                              // CMA
+            EACH_LANE(i) reg[7][i] ^= mask[i];
             break;
-        case 0xcc:  // CZ adr  (if Z, CALL adr)
-            if (state->cc.z)
-                CallAdr(state, opcode);
-            else
-                state->pc += 2;
+        case 0x37:                              // STC
+            EACH_LANE(i) psw[i] |= mask[i] & PSW_CY;
             break;
-        case 0xcd:  // CALL adr ((SP-1)<-PC.hi;(SP-2)<-PC.lo;SP<-SP-2;PC=adr)
-            CallAdr(state, opcode);
+        case 0x3f:                              // CMC
+            EACH_LANE(i) psw[i] ^= mask[i] & PSW_CY;
             break;
-        case 0xce:  // ACI D8 (A <- A + data + CY)
+        default:
+            return 0;
+    }
+    EACH_LANE(i) lanes->pc[i] = Blend16(mask[i], next, lanes->pc[i]);
+    return 1;
+}
+
+// Memory and stack instructions, run lane by lane straight on the lane registers rather
+// than through each lane's State8080 and back; returns 0 for anything else. Same results
+// as the opcode bodies, cycles included, so it adds each lane's cycles itself.
+static int RunLaneMemory(Lanes8080* lanes, uint8_t op, const unsigned char* opcode, uint16_t pc,
+                         const uint8_t* mask)
+{
+    const int chunks = (lanes->count + LANE_CHUNK - 1) / LANE_CHUNK;
+    uint8_t (*reg)[LANES_8080] = lanes->reg;
+    uint8_t* psw = lanes->psw;
+    int dst = (op >> 3) & 7;
+    int src = op & 7;
+    int pair = (op >> 4) & 3;   // BC DE HL PSW for PUSH/POP
+    int alu = op >= 0x80 && op < 0xc0;
+    int conditional = (op & 0xc7) == 0xc0 || (op & 0xc7) == 0xc4;  // Rcc, Ccc
+    if (!((op >= 0x40 && op < 0x80 && (dst == 6) != (src == 6))   // MOV r, M / MOV M, r
+          || (alu && src == 6)                                      // ALU A, M
+          || op == 0x34 || op == 0x35 || op == 0x36                 // INR M, DCR M, MVI M
+          || op == 0x02 || op == 0x12 || op == 0x0a || op == 0x1a   // STAX, LDAX
+          || op == 0x32 || op == 0x3a                               // STA, LDA
+          || (op & 0xcf) == 0xc5 || (op & 0xcf) == 0xc1             // PUSH, POP
+          || op == 0xcd || op == 0xc9 || conditional))              // CALL, RET, Ccc, Rcc
+        return 0;
+
+    uint16_t address = (opcode[2] << 8) | opcode[1];    // only read where the op has one
+    uint8_t operand[LANES_8080];
+    EACH_LANE(i) {
+        if (!mask[i]) continue;
+        State8080* state = lanes->state[i];
+        uint16_t hl = (uint16_t) ((reg[4][i] << 8) | reg[5][i]);
+        uint16_t sp = lanes->sp[i];
+        uint16_t next = pc + 1;
+        int cycles = cycles8080[op];
+        int push = 0, pop = 0;
+        uint16_t pushed = 0, popped = 0;
+
+        if (op >= 0x40 && op < 0x80)
         {
-            uint16_t answer = (uint16_t) state->a + (uint16_t) opcode[1] + state->cc.cy;
-            SetFlags(&state->cc, answer);
-            state->a = answer & 0xff;
-            state->pc++;
+            if (src == 6) reg[dst][i] = READ_MEM(state, hl);
+            else WRITE_MEM(state, hl, reg[src][i]);
         }
-            break;
-        case 0xcf:  // RST 1    (CALL $8)
-            CallConstantAdr(state, 8);
-            break;
-        case 0xd0:  // RNC adr  (if NCY, RET)
-            if (state->cc.cy == 0)
-                Return(state);
-            break;
-        case 0xd1:  // POP D    E <- (sp); D <- (sp+1); sp <- sp+2
+        else if (alu)
+            operand[i] = READ_MEM(state, hl);
+        else if (conditional)
         {
-            state->e = state->memory[state->sp];
-            state->d = state->memory[state->sp+1];
-            state->sp += 2;
-        }
-            break;
-        case 0xd2:  // JNC adr  (if NCY, PC <- adr)
-            if (state->cc.cy == 0)
-                state->pc = (opcode[2] << 8) | opcode[1];
+            int taken = ((psw[i] >> condition_shift[dst >> 1]) & 1) == (dst & 1);
+            if ((op & 0xc7) == 0xc0) pop = taken;
             else
-                state->pc += 2;
-            break;
-        case 0xd3:  // OUT D8    special
-            state->pc++;
-            break;
-        case 0xd4:  // CNC adr  (if NCY, CALL adr)
-            if (state->cc.cy == 0)
-                CallAdr(state, opcode);
-            else
-                state->pc += 2;
-            break;
-        case 0xd5:  // PUSH D    (sp-2)<-E; (sp-1)<-D; sp <- sp - 2
-        {
-            state->memory[state->sp-1] = state->d;
-            state->memory[state->sp-2] = state->e;
-            state->sp = state->sp - 2;
+            {
+                push = taken;
+                pushed = pc + 3;
+                next = taken ? address : (uint16_t) (pc + 3);
+            }
+            if (taken) cycles += 6;
         }
-            break;
-        case 0xd6:  // SUI D8 (A <- A - data)
-        {
-            state->cc.cy = (state->a < opcode[1]);
-            state->a -= opcode[1];
-            SetFlagsNoCarry(&state->cc, state->a);
-
-            state->pc++;
+        else switch (op) {
+            case 0x34: case 0x35:
+            {
+                // The flags come from what is there afterwards, ROM included
+                WRITE_MEM(state, hl, (uint8_t) (READ_MEM(state, hl) + ((op & 1) ? 0xff : 1)));
+                uint8_t value = READ_MEM(state, hl);
+                psw[i] = (psw[i] & ~(PSW_Z | PSW_S | PSW_P)) | LaneZSP(value);
+                break;
+            }
+            case 0x36:
+                WRITE_MEM(state, hl, opcode[1]);
+                next = pc + 2;
+                break;
+            case 0x02: case 0x12:
+                WRITE_MEM(state, (uint16_t) ((reg[pair * 2][i] << 8) | reg[pair * 2 + 1][i]), reg[7][i]);
+                break;
+            case 0x0a: case 0x1a:
+                reg[7][i] = READ_MEM(state, (uint16_t) ((reg[pair * 2][i] << 8) | reg[pair * 2 + 1][i]));
+                break;
+            case 0x32:
+                WRITE_MEM(state, address, reg[7][i]);
+                next = pc + 3;
+                break;
+            case 0x3a:
+                reg[7][i] = READ_MEM(state, address);
+                next = pc + 3;
+                break;
+            case 0xc9:
+                pop = 1;
+                break;
+            case 0xcd:
+                push = 1;
+                pushed = pc + 3;
+                next = address;
+                break;
+            default:
+                if ((op & 0xcf) == 0xc5)
+                {
+                    push = 1;
+                    pushed = pair == 3 ? (uint16_t) ((reg[7][i] << 8) | (psw[i] & PSW_FLAGS))
+                                       : (uint16_t) ((reg[pair * 2][i] << 8) | reg[pair * 2 + 1][i]);
+                }
+                else
+                    pop = 1;
+                break;
         }
-            break;
-        case 0xd7:  // RST 2    (CALL $10)
-            CallConstantAdr(state, 10);
-            break;
-        case 0xd8:  // RC adr  (if CY, RET)
-            if (state->cc.cy)
-                Return(state);
-            break;
-        case 0xd9:  // NOP
-            break;
-        case 0xda:  // JC adr  (if CY, PC <- adr)
-            if (state->cc.cy)
-                state->pc = (opcode[2] << 8) | opcode[1];
-            else
-                state->pc += 2;
-            break;
-        case 0xdb:  // IN D8    special
-            state->pc++;
-            break;
-        case 0xdc:  // CC adr  (if CY, CALL adr)
-            if (state->cc.cy)
-                CallAdr(state, opcode);
-            else
-                state->pc += 2;
-            break;
-        case 0xdd:  // NOP
-            break;
-        case 0xde:  // SBI D8   A <- A - data - CY
+
+        // High byte at sp - 1 first, as in the opcode bodies
+        if (push)
         {
-            uint16_t answer = (uint16_t) state->a - (uint16_t) opcode[1] - state->cc.cy;
-            SetFlagsNoCarry(&state->cc, answer);
-            state->cc.cy = (state->a < (opcode[1] + state->cc.cy));
-            state->a = answer & 0xff;
-            state->pc++;
+            WRITE_MEM(state, (uint16_t) (sp - 1), pushed >> 8);
+            WRITE_MEM(state, (uint16_t) (sp - 2), pushed & 0xff);
+            sp -= 2;
         }
-            break;
-        case 0xdf:  // RST 3    (CALL $18)
-            CallConstantAdr(state, 18);
-            break;
-        case 0xe0:  // RPO  (if PO, RET)
-            if (state->cc.p == 0)
-                Return(state);
-            break;
-        case 0xe1:  // POP B    L <- (sp); H <- (sp+1); sp <- sp+2
+        if (pop)
         {
-            state->l = state->memory[state->sp];
-            state->h = state->memory[state->sp+1];
-            state->sp += 2;
-        }
-            break;
-        case 0xe2:  // JPO  (if PO, PC <- adr)
-            if (state->cc.p == 0)
-                state->pc = (opcode[2] << 8) | opcode[1];
+            popped = (uint16_t) ((READ_MEM(state, sp + 1) << 8) | READ_MEM(state, sp));
+            sp += 2;
+            if ((op & 0xcf) == 0xc1 && pair == 3)
+            {
+                reg[7][i] = popped >> 8;
+                psw[i] = popped & PSW_FLAGS;
+            }
+            else if ((op & 0xcf) == 0xc1)
+            {
+                reg[pair * 2][i] = popped >> 8;
+                reg[pair * 2 + 1][i] = popped & 0xff;
+            }
             else
-                state->pc += 2;
-            break;
-        case 0xe3:  // XTHL 	L <-> (SP); H <-> (SP+1)
-        {
-            uint8_t temp = state->l;
-            state->l = state->memory[state->sp];
-            state->memory[state->sp] = temp;
+                next = popped;
+        }
+        lanes->sp[i] = sp;
+        lanes->pc[i] = next;
+        lanes->cycles[i] += cycles;
+    }
+    if (alu) AluLanes(lanes, dst, operand, mask);
+    return 1;
+}
+
+// Hands the lanes in stopped to on_exit, and takes the ones it doesn't resume out of running
+static void ExitLanes(Lanes8080* lanes, uint32_t stopped, LaneExit8080 on_exit, void* user)
+{
+    const int chunks = (lanes->count + LANE_CHUNK - 1) / LANE_CHUNK;
+    EACH_LANE(i) {
+        if (((stopped >> i) & 1) && !on_exit(user, lanes, i)) lanes->running &= ~(1u << i);
+    }
+}
+
+// Runs a lane that is alone at the lowest pc on its own State8080 until it gets to until,
+// the next lowest pc, or stops. The lowest pc rule would have issued it alone all that way;
+// this skips the pass over the lanes for every instruction. Returns the lane's bit if it
+// stopped, with the reason in lanes->exit.
+static uint32_t RunLoneLane(Lanes8080* lanes, int lane, uint16_t until)
+{
+    State8080* state = lanes->state[lane];
+    uint32_t stopped = 0;
+    StoreLane8080(lanes, lane);
+    do {
+        unsigned char* opcode = FETCH(state, state->pc);
+        uint8_t op = *opcode;
+        if (op == 0xdb || op == 0xd3 || op == 0x76)
+        {
+            lanes->exit[lane] = op == 0xdb ? EXIT_IN : op == 0xd3 ? EXIT_OUT : EXIT_HLT;
+            stopped = 1u << lane;
+            break;
+        }
+        lanes->steps++;
+        lanes->lane_steps++;
+        state->instructions++;
+        state->pc += 1;
+        int cycles = cycles8080[op];
+        switch (op) {
+#define OPCODE(n) case n:
+#include "8080ops.h"
+#undef OPCODE
+        }
+        lanes->cycles[lane] += cycles;
+        if (op == 0xfb)
+        {
+            lanes->exit[lane] = EXIT_EI;
+            stopped = 1u << lane;
+        }
+        else if (lanes->cycles[lane] >= lanes->budget[lane])
+        {
+            lanes->exit[lane] = EXIT_BUDGET;
+            stopped = 1u << lane;
+        }
+    } while (!stopped && state->pc < until);
+    MATERIALIZE_ZSP(state);
+    LoadLane8080(lanes, lane, state);
+    return stopped;
+}
 
-            temp = state->h;
-            state->h = state->memory[state->sp + 1];
-            state->memory[state->sp + 1] = temp;
+void RunLanes8080(Lanes8080* lanes, LaneExit8080 on_exit, void* user)
+{
+    const int chunks = (lanes->count + LANE_CHUNK - 1) / LANE_CHUNK;
+    uint8_t mask[LANES_8080];
+    while (lanes->running)
+    {
+        // The lowest pc goes first: lanes that took a longer path wait there for the
+        // others to catch up, and every lane at that pc runs the instruction together
+        uint32_t running = lanes->running;
+        uint16_t pc = 0xffff, next = 0xffff;
+        int leader = 0;
+        EACH_LANE(i) {
+            if (!((running >> i) & 1)) continue;
+            if (lanes->pc[i] <= pc)
+            {
+                next = pc;
+                pc = lanes->pc[i];
+                leader = i;
+            }
+            else if (lanes->pc[i] < next)
+                next = lanes->pc[i];
         }
-            break;
-        case 0xe4:  // CPO adr  (if PO, CALL adr)
-            if (state->cc.p == 0)
-                CallAdr(state, opcode);
-            else
-                state->pc += 2;
-            break;
-        case 0xe5:  // PUSH H    (sp-2)<-L; (sp-1)<-H; sp <- sp - 2
+        // Lanes only share the instruction bytes when they share the page, i.e. the ROM
+        const uint8_t* code = lanes->state[leader]->map->read[pc >> 8];
+        uint32_t group = 1u << leader;
+        if ((pc & 0xff) < 0xfe)
         {
-            state->memory[state->sp-1] = state->h;
-            state->memory[state->sp-2] = state->l;
-            state->sp = state->sp - 2;
+            EACH_LANE(i) {
+                if (((running >> i) & 1) && lanes->pc[i] == pc && lanes->state[i]->map->read[pc >> 8] == code)
+                    group |= 1u << i;
+            }
         }
-            break;
-        case 0xe6:  // ANI D8   (A <-A & data)
-            state->a &= opcode[1];
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;   // ANI always clears CY
-            state->pc++;
-            break;
-        case 0xe7:  // RST 4    (CALL $20)
-            CallConstantAdr(state, 20);
-            break;
-        case 0xe8:  // RPE  (if PE, RET)
-            if (state->cc.p)
-                Return(state);
-            break;
-        case 0xe9:  // PCHL (PC.hi <- H; PC.lo <- L)
-            state->pc = (state->h << 8) | state->l;
-            break;
-        case 0xea:  // JPE  (if PE, PC <- adr)
-            if (state->cc.p)
-                state->pc = (opcode[2] << 8) | opcode[1];
-            else
-                state->pc += 2;
-            break;
-        case 0xeb:  // XCHG 	H <-> D; L <-> E
-        {
-            uint8_t temp = state->h;
-            state->h = state->d;
-            state->d = temp;
+        unsigned char* opcode = FETCH(lanes->state[leader], pc);
+        uint8_t op = *opcode;
 
-            temp = state->l;
-            state->l = state->e;
-            state->e = temp;
-        }
-            break;
-        case 0xec:  // CPE adr  (if PE, CALL adr)
-            if (state->cc.p)
-                CallAdr(state, opcode);
-            else
-                state->pc += 2;
-            break;
-        case 0xed:  // NOP
-            break;
-        case 0xee:  // XRI D8   A <- A ^ data
-            state->a ^= opcode[1];
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            state->pc++;
-            break;
-        case 0xef:  // RST 5    (CALL $28)
-            CallConstantAdr(state, 28);
-            break;
-        case 0xf0:  // RP plus sign  (if P, RET)
-            if (state->cc.s == 0)
-                Return(state);
-            break;
-        case 0xf1:  // POP PSW   flags <- (sp); A <- (sp+1); sp <- sp+2
+        // IN/OUT/HLT are left for on_exit, like Run8080 leaves them for its caller
+        if (op == 0xdb || op == 0xd3 || op == 0x76)
         {
-            state->a = state->memory[state->sp+1];
-            // Low 5 bits store each flag ac-cy-p-s-z
-            uint8_t psw = state->memory[state->sp];
-            state->cc.z  = (0x01 == (psw & 0x01));
-            state->cc.s  = (0x02 == (psw & 0x02));
-            state->cc.p  = (0x04 == (psw & 0x04));
-            state->cc.cy = (0x08 == (psw & 0x08));
-            state->cc.ac = (0x10 == (psw & 0x10));
-            state->sp += 2;
+            Exit8080 reason = op == 0xdb ? EXIT_IN : op == 0xd3 ? EXIT_OUT : EXIT_HLT;
+            EACH_LANE(i) {
+                if ((group >> i) & 1) lanes->exit[i] = reason;
+            }
+            ExitLanes(lanes, group, on_exit, user);
+            continue;
         }
-            break;
-        case 0xf2:  // JP plus for sign (if P, PC <- adr)
-            if (state->cc.s == 0)
-                state->pc = (opcode[2] << 8) | opcode[1];
-            else
-                state->pc += 2;
-            break;
-        case 0xf3:  // DI   special disable interrupt
-            state->int_enable = 0;
-            break;
-        case 0xf4:  // CP adr plus sign  (if PO, CALL adr)
-            if (state->cc.s == 0)
-                CallAdr(state, opcode);
-            else
-                state->pc += 2;
-            break;
-        case 0xf5:  // PUSH PSW  (sp-2)<-flags; (sp-1)<-A; sp <- sp - 2
+        if (group == 1u << leader)
         {
-            state->memory[state->sp-1] = state->a;
-            // Low 5 bits store each flag ac-cy-p-s-z
-            uint8_t psw = (state->cc.z |
-                           state->cc.s << 1 |
-                           state->cc.p << 2 |
-                           state->cc.cy << 3 |
-                           state->cc.ac << 4 );
-            state->sp -= 2;
-            state->memory[state->sp] = psw;
+            uint32_t stopped = RunLoneLane(lanes, leader, next);
+            if (stopped) ExitLanes(lanes, stopped, on_exit, user);
+            continue;
         }
-            break;
-        case 0xf6:  // ORI D8   A <- A | data
-            state->a |= opcode[1];
-            SetFlagsNoCarry(&state->cc, state->a);
-            state->cc.cy = 0;
-            state->pc++;
-            break;
-        case 0xf7:  // RST 6    (CALL $30)
-            CallConstantAdr(state, 30);
-            break;
-        case 0xf8:  // RM minus sign  (if M, RET)
-            if (state->cc.s)
-                Return(state);
-            break;
-        case 0xf9:  // SPHL SP=HL
-            state->sp = (state->h << 8) | state->l;
-            break;
-        case 0xfa:  // JM minus for sign (if M, PC <- adr)
-            if (state->cc.s)
-                state->pc = (opcode[2] << 8) | opcode[1];
-            else
-                state->pc += 2;
-            break;
-        case 0xfb:  // EI   special enable interrupt
-            state->int_enable = 1;
-            break;
-        case 0xfc:  // CM adr minus sign  (if M, CALL adr)
-            if (state->cc.s)
-                CallAdr(state, opcode);
-            else
-                state->pc += 2;
-            break;
-        case 0xfd:  // NOP
-            break;
-        case 0xfe:  // CPI D8   (A - data)
-        {
-            SetFlagsNoCarry(&state->cc, state->a - opcode[1]);
-            state->cc.cy = (state->a < opcode[1]);
-            state->pc++;
+
+        lanes->steps++;
+        EACH_LANE(i) {
+            mask[i] = (uint8_t) -((group >> i) & 1);
+            lanes->lane_steps += mask[i] & 1;
+        }
+        if (RunLaneKernel(lanes, op, opcode, pc, mask))
+        {
+            lanes->vector_steps++;
+            EACH_LANE(i) lanes->cycles[i] += cycles8080[op] & -(int32_t) (mask[i] & 1);
+        }
+        else if (!RunLaneMemory(lanes, op, opcode, pc, mask))
+        {
+            // Everything else runs lane by lane on the shared opcode bodies
+            EACH_LANE(lane) {
+                if (!mask[lane]) continue;
+                State8080* state = lanes->state[lane];
+                StoreLane8080(lanes, lane);
+                state->pc = pc + 1;
+                int cycles = cycles8080[op];
+                switch (op) {
+#define OPCODE(n) case n:
+#include "8080ops.h"
+#undef OPCODE
+                }
+                MATERIALIZE_ZSP(state);
+                LoadLane8080(lanes, lane, state);
+                lanes->cycles[lane] += cycles;
+            }
         }
-            break;
-        case 0xff:  // RST 7    (CALL $38)
-            CallConstantAdr(state, 38);
-            break;
+
+        // Retire the instruction and stop lanes that used their budget or just ran EI
+        uint32_t stopped = 0;
+        EACH_LANE(i) {
+            if (!((group >> i) & 1)) continue;
+            lanes->instructions[i]++;
+            if (op == 0xfb)
+            {
+                lanes->exit[i] = EXIT_EI;
+                stopped |= 1u << i;
+            }
+            else if (lanes->cycles[i] >= lanes->budget[i])
+            {
+                lanes->exit[i] = EXIT_BUDGET;
+                stopped |= 1u << i;
+            }
+        }
+        if (stopped) ExitLanes(lanes, stopped, on_exit, user);
     }
-    return 0;
 }
 
-uint8_t Parity(uint8_t answer)
+// Copies the three bytes an instruction can span into state->fetch
+static unsigned char* FetchAcrossPages(State8080* state, uint16_t address)
 {
-    int i;
-    int count = 0;
-    for (i = 0; i < 8; i++)
-    {
-        if (answer & 0x1) count++;
-        answer >>= 1;
-    }
-    return (count & 0x1) == 0;
+    for (int i = 0; i < 3; i++)
+        state->fetch[i] = READ_MEM(state, address + i);
+    return state->fetch;
 }
 
-void SetFlags(ConditionCodes* cc, uint16_t answer)
+uint8_t ReadMem8080(State8080* state, uint16_t address)
 {
-    // update flags Z, S, P, CY, AC (skip AC because Space Invaders doesn't use it)
-    cc->z = ((answer & 0xff) == 0); // zero: check lowest 8 bits equals 0
-    cc->s = ((answer & 0x80) != 0); // sign: check bit 7 0x80 = 0b1000 0000
-    cc->p = Parity(answer&0xff);
+    return READ_MEM(state, address);
+}
+
+void WriteMem8080(State8080* state, uint16_t address, uint8_t value)
+{
+    WRITE_MEM(state, address, value);
+}
+
+// Z, S and P for every 8 bit result, bit 0 = Z, bit 1 = S, bit 2 = P (even parity),
+// the same positions as in ConditionCodes.psw so it can be or'ed straight in
+static const uint8_t zsp_table[256] = {
+        5, 0, 0, 4, 0, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 4, //0x00..0x0f
+        0, 4, 4, 0, 4, 0, 0, 4, 4, 0, 0, 4, 0, 4, 4, 0, //0x10..0x1f
+        0, 4, 4, 0, 4, 0, 0, 4, 4, 0, 0, 4, 0, 4, 4, 0,
+        4, 0, 0, 4, 0, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 4,
+        0, 4, 4, 0, 4, 0, 0, 4, 4, 0, 0, 4, 0, 4, 4, 0,
+        4, 0, 0, 4, 0, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 4,
+        4, 0, 0, 4, 0, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 4,
+        0, 4, 4, 0, 4, 0, 0, 4, 4, 0, 0, 4, 0, 4, 4, 0,
+        2, 6, 6, 2, 6, 2, 2, 6, 6, 2, 2, 6, 2, 6, 6, 2,
+        6, 2, 2, 6, 2, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 6,
+        6, 2, 2, 6, 2, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 6,
+        2, 6, 6, 2, 6, 2, 2, 6, 6, 2, 2, 6, 2, 6, 6, 2,
+        6, 2, 2, 6, 2, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 6,
+        2, 6, 6, 2, 6, 2, 2, 6, 6, 2, 2, 6, 2, 6, 6, 2,
+        2, 6, 6, 2, 6, 2, 2, 6, 6, 2, 2, 6, 2, 6, 6, 2,
+        6, 2, 2, 6, 2, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 6,
+};
+
+#ifdef LAZY_FLAGS
+static void MaterializeZSP(ConditionCodes* cc)
+{
+    cc->psw = (cc->psw & ~(PSW_Z | PSW_S | PSW_P)) | zsp_table[cc->lazy_result];
+    cc->lazy_pending = 0;
+}
+
+static void SetFlags(ConditionCodes* cc, uint16_t answer)
+{
+    cc->lazy_result = answer & 0xff;
+    cc->lazy_pending = 1;
     cc->cy = (answer > 0xff);       // carry: check if it overflowed over 8 bits
 }
 
-void SetFlagsNoCarry(ConditionCodes* cc, uint16_t answer)
+static void SetFlagsNoCarry(ConditionCodes* cc, uint16_t answer)
+{
+    cc->lazy_result = answer & 0xff;
+    cc->lazy_pending = 1;
+}
+
+static void SetFlagsLogic(ConditionCodes* cc, uint8_t answer)
+{
+    cc->lazy_result = answer;
+    cc->lazy_pending = 1;
+    cc->cy = 0;
+}
+#else
+static void SetFlags(ConditionCodes* cc, uint16_t answer)
 {
     // update flags Z, S, P, CY, AC (skip AC because Space Invaders doesn't use it)
-    cc->z = ((answer & 0xff) == 0); // zero: check lowest 8 bits equals 0
-    cc->s = ((answer & 0x80) != 0); // sign: check bit 7 0x80 = 0b1000 0000
-    cc->p = Parity(answer&0xff);
+    uint8_t cy = (answer > 0xff) ? PSW_CY : 0;     // carry: check if it overflowed over 8 bits
+    cc->psw = (cc->psw & ~(PSW_Z | PSW_S | PSW_P | PSW_CY)) | zsp_table[answer & 0xff] | cy;
+}
+
+static void SetFlagsNoCarry(ConditionCodes* cc, uint16_t answer)
+{
+    cc->psw = (cc->psw & ~(PSW_Z | PSW_S | PSW_P)) | zsp_table[answer & 0xff];
+}
+
+// AND/OR/XOR: Z, S, P from the result, CY always cleared
+static void SetFlagsLogic(ConditionCodes* cc, uint8_t answer)
+{
+    cc->psw = (cc->psw & ~(PSW_Z | PSW_S | PSW_P | PSW_CY)) | zsp_table[answer];
+}
+#endif
+
+void Materialize8080Flags(State8080* state)
+{
+    MATERIALIZE_ZSP(state);
 }
 
-void CallAdr(State8080* state, const unsigned char *opcode)
+static void CallAdr(State8080* state, const unsigned char *opcode)
 {
     // store return address on stack, then set pc to call address
     // pc is 16bits, memory is 8 bits, so use 2 slots in stack
     uint16_t ret = state->pc + 2;
-    state->memory[state->sp - 1] = (ret >> 8) & 0xff; // bits 8-15 stored in sp-1
-    state->memory[state->sp - 2] = (ret & 0xff);      // bits 0-7 stored in sp-2
+    WRITE_MEM(state, state->sp - 1, (ret >> 8) & 0xff); // bits 8-15 stored in sp-1
+    WRITE_MEM(state, state->sp - 2, (ret & 0xff));      // bits 0-7 stored in sp-2
     state->sp -= 2;
     state->pc = (opcode[2] << 8) | opcode[1];
 }
 
-void CallConstantAdr(State8080* state, uint8_t adr)
+static void CallConstantAdr(State8080* state, uint8_t adr)
 {
     // store return address on stack, then set pc to call address
     // pc is 16bits, memory is 8 bits, so use 2 slots in stack
     uint16_t ret = state->pc + 2;
-    state->memory[state->sp - 1] = (ret >> 8) & 0xff; // bits 8-15 stored in sp-1
-    state->memory[state->sp - 2] = (ret & 0xff);      // bits 0-7 stored in sp-2
+    WRITE_MEM(state, state->sp - 1, (ret >> 8) & 0xff); // bits 8-15 stored in sp-1
+    WRITE_MEM(state, state->sp - 2, (ret & 0xff));      // bits 0-7 stored in sp-2
     state->sp -= 2;
     state->pc = adr;
 }
 
-void Return(State8080* state)
+static void Return(State8080* state)
 {
     // Restore pc by popping return address off stack (16 bit adr gets stored in 2 slots)
     //              bits 8-15                           bits 0-7
-    state->pc = (state->memory[state->sp+1] << 8) | state->memory[state->sp];
+    state->pc = (READ_MEM(state, state->sp + 1) << 8) | READ_MEM(state, state->sp);
     state->sp += 2;
 }
 
-void SBB_Register(uint8_t register_val, State8080* state)
+static void SBB_Register(uint8_t register_val, State8080* state)
 {
     uint8_t new_carry = state->a < (register_val + state->cc.cy);
     state->a  -= register_val + state->cc.cy;
@@ -1367,6 +882,8 @@ void SBB_Register(uint8_t register_val, State8080* state)
 }
 
 
+// Cycles per opcode. Conditional RET/CALL entries are the not-taken cost,
+// the cores add 6 when the branch is taken.
 unsigned char cycles8080[] = {
         4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4, //0x00..0x0f
         4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4, //0x10..0x1f
@@ -1383,8 +900,8 @@ unsigned char cycles8080[] = {
         4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
         4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
 
-        11, 10, 10, 10, 17, 11, 7, 11, 11, 10, 10, 10, 10, 17, 7, 11, //0xc0..0xcf
-        11, 10, 10, 10, 17, 11, 7, 11, 11, 10, 10, 10, 10, 17, 7, 11,
-        11, 10, 10, 18, 17, 11, 7, 11, 11, 5, 10, 5, 17, 17, 7, 11,
-        11, 10, 10, 4, 17, 11, 7, 11, 11, 5, 10, 4, 17, 17, 7, 11,
+        5, 10, 10, 10, 11, 11, 7, 11, 5, 10, 10, 10, 11, 17, 7, 11, //0xc0..0xcf
+        5, 10, 10, 10, 11, 11, 7, 11, 5, 10, 10, 10, 11, 17, 7, 11,
+        5, 10, 10, 18, 11, 11, 7, 11, 5, 5, 10, 4, 11, 17, 7, 11,
+        5, 10, 10, 4, 11, 11, 7, 11, 5, 5, 10, 4, 11, 17, 7, 11,
 };
\ No newline at end of file
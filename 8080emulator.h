@@ -3,30 +3,91 @@
 
 #include <stdint.h>
 extern unsigned char cycles8080[];
+// Register pairs and the flag byte are unions so 16-bit and PSW handlers
+// can work on the whole value. Byte order of the halves follows the host.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(hi, lo)   union { struct { uint8_t hi, lo; }; uint16_t hi##lo; }
+#else
+#define REGISTER_PAIR(hi, lo)   union { struct { uint8_t lo, hi; }; uint16_t hi##lo; }
+#endif
+
+// Bits of ConditionCodes.psw, in the order PUSH PSW stores them
+#define PSW_Z       0x01
+#define PSW_S       0x02
+#define PSW_P       0x04
+#define PSW_CY      0x08
+#define PSW_AC      0x10
+#define PSW_FLAGS   0x1f
+
 typedef struct ConditionCodes {
-    uint8_t    z:1;
-    uint8_t    s:1;
-    uint8_t    p:1;
-    uint8_t    cy:1;
-    uint8_t    ac:1;
-    uint8_t    pad:3;
+    union {
+        struct {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            uint8_t    pad:3;
+            uint8_t    ac:1;
+            uint8_t    cy:1;
+            uint8_t    p:1;
+            uint8_t    s:1;
+            uint8_t    z:1;
+#else
+            uint8_t    z:1;
+            uint8_t    s:1;
+            uint8_t    p:1;
+            uint8_t    cy:1;
+            uint8_t    ac:1;
+            uint8_t    pad:3;
+#endif
+        };
+        uint8_t    psw;     // all flags at once, see PSW_*
+    };
+    // LAZY_FLAGS builds: Z/S/P of lazy_result are owed to the bits above
+    uint8_t    lazy_result;
+    uint8_t    lazy_pending;
 } ConditionCodes;
 
 typedef struct State8080 {
     uint8_t    a;
-    uint8_t    b;
-    uint8_t    c;
-    uint8_t    d;
-    uint8_t    e;
-    uint8_t    h;
-    uint8_t    l;
+    REGISTER_PAIR(b, c);
+    REGISTER_PAIR(d, e);
+    REGISTER_PAIR(h, l);
     uint16_t    sp;
     uint16_t    pc;
-    uint8_t     *memory;
+    uint8_t     *memory;        // flat backing store the map points into, if any, for loaders and tools
+    struct      MemoryMap8080*      map;        // what the CPU sees at each address
+    uint8_t     fetch[3];       // copy of an instruction that straddles two pages
     struct      ConditionCodes      cc;
     uint8_t     int_enable;
+    uint64_t    instructions;   // instructions retired since reset
+    struct      BlockCache8080*     blocks;     // optional, set to run Emulate8080Block
+    struct      Profile8080*        profile;    // optional, filled in by PROFILE builds
+    uint8_t*    dirty_lines;    // optional, for write handlers that track changed 32 byte lines
 } State8080;
 
-int Emulate8080Op(State8080* state);
+// Why Run8080 returned
+typedef enum Exit8080 {
+    EXIT_BUDGET,    // cycle budget used up
+    EXIT_IN,        // pc is on an IN instruction, not yet run
+    EXIT_OUT,       // pc is on an OUT instruction, not yet run
+    EXIT_HLT,       // pc is on HLT
+    EXIT_EI,        // EI just ran, interrupts can be delivered
+} Exit8080;
+
+// Each of these runs one instruction (or one block) and returns the cycles it took
+int Emulate8080Op(State8080* state);            // switch dispatch
+int Emulate8080OpThreaded(State8080* state);    // computed-goto dispatch, same results
+// Runs a decoded basic block, leaving it early once cycle_budget cycles have run, so it
+// stops on the same instruction as the other cores given the same budget
+int Emulate8080Block(State8080* state, int cycle_budget);
+int Run8080(State8080* state, int cycle_budget, Exit8080* reason);   // returns cycles used
+// Called for a lane that stopped the way Run8080 would (budget, IN/OUT/HLT, EI), with the
+// reason in lanes->exit[lane]; returns nonzero when the lane goes on running
+struct Lanes8080;
+typedef int (*LaneExit8080)(void* user, struct Lanes8080* lanes, int lane);
+// Runs every lane in lanes->running, in lockstep wherever their pcs meet. A lane that stops
+// is handed to on_exit while the others keep going; returns once no lane is running.
+void RunLanes8080(struct Lanes8080* lanes, LaneExit8080 on_exit, void* user);
+void Materialize8080Flags(State8080* state);   // bring state->cc up to date (LAZY_FLAGS)
+uint8_t ReadMem8080(State8080* state, uint16_t address);
+void WriteMem8080(State8080* state, uint16_t address, uint8_t value);
 
 #endif //INC_8080EMULATOR_8080EMULATOR_H
@@ -0,0 +1,34 @@
+#include "8080lanes.h"
+
+void LoadLane8080(Lanes8080* lanes, int lane, State8080* state)
+{
+    Materialize8080Flags(state);
+    lanes->state[lane] = state;
+    lanes->reg[0][lane] = state->b;
+    lanes->reg[1][lane] = state->c;
+    lanes->reg[2][lane] = state->d;
+    lanes->reg[3][lane] = state->e;
+    lanes->reg[4][lane] = state->h;
+    lanes->reg[5][lane] = state->l;
+    lanes->reg[7][lane] = state->a;
+    lanes->psw[lane] = state->cc.psw;
+    lanes->sp[lane] = state->sp;
+    lanes->pc[lane] = state->pc;
+    lanes->instructions[lane] = state->instructions;
+}
+
+void StoreLane8080(Lanes8080* lanes, int lane)
+{
+    State8080* state = lanes->state[lane];
+    state->b = lanes->reg[0][lane];
+    state->c = lanes->reg[1][lane];
+    state->d = lanes->reg[2][lane];
+    state->e = lanes->reg[3][lane];
+    state->h = lanes->reg[4][lane];
+    state->l = lanes->reg[5][lane];
+    state->a = lanes->reg[7][lane];
+    state->cc.psw = lanes->psw[lane];
+    state->sp = lanes->sp[lane];
+    state->pc = lanes->pc[lane];
+    state->instructions = lanes->instructions[lane];
+}
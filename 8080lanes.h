@@ -0,0 +1,37 @@
+#ifndef INC_8080EMULATOR_8080LANES_H
+#define INC_8080EMULATOR_8080LANES_H
+
+#include <stdint.h>
+#include "8080emulator.h"
+
+#define LANES_8080  32      // CPUs in one lane group, one bit each in the uint32_t masks
+
+// Registers of up to LANES_8080 CPUs in structure-of-arrays form: one array per register,
+// lane i of every array belonging to the same CPU. reg[] is indexed by the 3 bit register
+// field of the opcodes (B C D E H L - A), so MOV, MVI, INR/DCR and the ALU ops index it
+// straight from the opcode; reg[6] (M) is unused. Everything else about a lane (memory
+// map, interrupt enable, block cache) stays in its State8080.
+typedef struct Lanes8080 {
+    uint8_t     reg[8][LANES_8080];
+    uint8_t     psw[LANES_8080];            // ConditionCodes.psw, always materialized
+    uint16_t    sp[LANES_8080];
+    uint16_t    pc[LANES_8080];
+    uint64_t    instructions[LANES_8080];
+    int32_t     cycles[LANES_8080];         // run since the caller last reset them
+    int32_t     budget[LANES_8080];         // a lane stops once cycles reaches this
+    Exit8080    exit[LANES_8080];           // why a lane stopped
+    State8080*  state[LANES_8080];
+    int         count;                      // lanes in use, 0 .. count - 1; passes cover only these
+    uint32_t    running;                    // lanes RunLanes8080 advances
+
+    uint64_t    steps;          // stats: instructions issued to a group of lanes,
+    uint64_t    lane_steps;     // lanes they covered,
+    uint64_t    vector_steps;   // and how many of the steps ran as one pass over all lanes
+} Lanes8080;
+
+// Copies state's registers into lane, which then belongs to state
+void LoadLane8080(Lanes8080* lanes, int lane, State8080* state);
+// Copies lane's registers back to its State8080
+void StoreLane8080(Lanes8080* lanes, int lane);
+
+#endif //INC_8080EMULATOR_8080LANES_H
@@ -0,0 +1,20 @@
+#include <stddef.h>
+#include "8080memory.h"
+
+void MapPages8080(MemoryMap8080* map, int first_page, int count, uint8_t* base, int writable,
+                  WriteHandler8080 write_handler)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t* page = base + i * PAGE_SIZE;
+        int index = first_page + i;
+        map->read[index] = page;
+        map->write[index] = writable ? page : NULL;
+        map->write_handler[index] = writable ? NULL : write_handler;
+    }
+}
+
+void MapFlat8080(MemoryMap8080* map, uint8_t* memory)
+{
+    MapPages8080(map, 0, PAGE_COUNT, memory, 1, NULL);
+}
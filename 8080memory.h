@@ -0,0 +1,29 @@
+#ifndef INC_8080EMULATOR_8080MEMORY_H
+#define INC_8080EMULATOR_8080MEMORY_H
+
+#include <stdint.h>
+
+#define PAGE_SIZE   0x100
+#define PAGE_COUNT  0x100
+
+struct State8080;
+typedef void (*WriteHandler8080)(struct State8080* state, uint16_t address, uint8_t value);
+
+// Where each 256 byte page of the address space lives. read[page][offset] is the byte at
+// (page << 8) | offset. Plain RAM pages have a write pointer too and are stored to
+// directly; pages without one call their write handler (video RAM, devices) or drop
+// the write when there is no handler (ROM).
+typedef struct MemoryMap8080 {
+    uint8_t*            read[PAGE_COUNT];
+    uint8_t*            write[PAGE_COUNT];
+    WriteHandler8080    write_handler[PAGE_COUNT];
+} MemoryMap8080;
+
+// Maps pages [first_page, first_page + count) onto consecutive pages starting at base;
+// write_handler is only used when writable is 0
+void MapPages8080(MemoryMap8080* map, int first_page, int count, uint8_t* base, int writable,
+                  WriteHandler8080 write_handler);
+// The whole 64K as plain RAM at memory
+void MapFlat8080(MemoryMap8080* map, uint8_t* memory);
+
+#endif //INC_8080EMULATOR_8080MEMORY_H
@@ -0,0 +1,1286 @@
+/*
+ * Opcode bodies shared by every interpreter core in 8080emulator.c.
+ * The including core defines OPCODE(n) as its dispatch label (a switch case or
+ * a computed-goto target); each body ends in `break`, which leaves the dispatch.
+ * On entry `opcode` points at the instruction and state->pc is already past it,
+ * and `cycles` holds cycles8080[] for it; bodies add the extra cost of a taken branch.
+ * Loads go through READ_MEM and stores through WRITE_MEM, which look the page up in
+ * state->map; WRITE_MEM also lets the block cache see writes to translated code.
+ * Anything that reads Z/S/P calls MATERIALIZE_ZSP first (a no-op unless LAZY_FLAGS).
+ */
+
+OPCODE(0x00)  // NOP
+    break;
+OPCODE(0x01)  // LXI B, D16   B <- byte 3, C <- byte 2
+    state->bc = (opcode[2] << 8) | opcode[1];
+    state->pc += 2;
+    break;
+OPCODE(0x02)  // STAX B   (BC) <- A
+{
+    uint16_t address = state->bc;
+    WRITE_MEM(state, address, state->a);
+}
+    break;
+OPCODE(0x03)  // INX  	BC <- BC+1
+    state->bc++;
+    break;
+OPCODE(0x04)  // INR B	B <- B+1
+    state->b++;
+    SetFlagsNoCarry(&state->cc, state->b);
+    break;
+OPCODE(0x05)  // DCR B    B <- B-1
+    state->b--;
+    SetFlagsNoCarry(&state->cc, state->b);
+    break;
+OPCODE(0x06)  // MVI B, D8    B <- byte2
+    state->b = opcode[1];
+    state->pc++;
+    break;
+OPCODE(0x07)  // RLC  	A = A << 1; bit 0 = prev bit 7; CY = prev bit 7
+{
+    uint8_t a = state->a;
+    // bit 7 wraps around to bit 0, everything else goes left
+    state->a = ((a & 0x80) >> 7) | (a << 1);
+    state->cc.cy = state->a & 1;
+}
+    break;
+OPCODE(0x08)  // NOP
+    break;
+OPCODE(0x09)  // DAD B    HL = HL + BC
+{
+    uint32_t hl = (uint32_t) state->hl + state->bc;
+    state->hl = hl & 0xffff;
+    state->cc.cy = (hl > 0xffff);   // only set carry
+}
+    break;
+OPCODE(0x0a)  // LDAX B   A <- (BC)
+{
+    uint16_t address = state->bc;
+    state->a = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x0b)  // DCX  	BC <- BC-1
+    state->bc--;
+    break;
+OPCODE(0x0c)  // INR C	C <- C+1
+    state->c++;
+    SetFlagsNoCarry(&state->cc, state->c);
+    break;
+OPCODE(0x0d)  // DCR C    C <- C-1
+    state->c--;
+    SetFlagsNoCarry(&state->cc, state->c);
+    break;
+OPCODE(0x0e)  // MVI C, D8    C <- byte 2
+    state->c = opcode[1];
+    state->pc++;
+    break;
+OPCODE(0x0f)  // RRC      A = A >> 1; bit 7 = prev bit 0; CY = prev bit 0
+{
+    uint8_t a = state->a;
+    // bit 0 wraps around to bit 7, everything else goes right
+    state->a = ((a & 1) << 7) | (a >> 1);
+    state->cc.cy = a & 1;
+}
+    break;
+OPCODE(0x10)  // NOP
+    break;
+OPCODE(0x11)  // LXI D, D16   D <- byte 3, E <- byte 2
+    state->de = (opcode[2] << 8) | opcode[1];
+    state->pc += 2;
+    break;
+OPCODE(0x12)  // STAX D   (DE) <- A
+{
+    uint16_t address = state->de;
+    WRITE_MEM(state, address, state->a);
+}
+    break;
+OPCODE(0x13)  // INX D 	DE <- DE+1
+    state->de++;
+    break;
+OPCODE(0x14)  // INR D	D <- D+1
+    state->d++;
+    SetFlagsNoCarry(&state->cc, state->d);
+    break;
+OPCODE(0x15)  // DCR D    D <- D-1
+    state->d--;
+    SetFlagsNoCarry(&state->cc, state->d);
+    break;
+OPCODE(0x16)  // MVI D, D8    D <- byte2
+    state->d = opcode[1];
+    state->pc++;
+    break;
+OPCODE(0x17)  // RAL  	A = A << 1; bit 0 = prev CY; CY = prev bit 7
+{
+    uint8_t a = state->a;
+    // bit 0 is prev carry, everything else goes left
+    state->a = ((state->cc.cy) >> 7) | (a << 1);
+    state->cc.cy = (a & 0x80) == 0x80;
+}
+    break;
+OPCODE(0x18)  // NOP
+    break;
+OPCODE(0x19)  // DAD B    HL = HL + DE
+{
+    uint32_t hl = (uint32_t) state->hl + state->de;
+    state->hl = hl & 0xffff;
+    state->cc.cy = (hl > 0xffff);   // only set carry
+}
+    break;
+OPCODE(0x1a)  // LDAX D   A <- (DE)
+{
+    uint16_t address = state->de;
+    state->a = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x1b)  // DCX D 	DE <- DE-1
+    state->de--;
+    break;
+OPCODE(0x1c)  // INR E	E <- E+1
+    state->e++;
+    SetFlagsNoCarry(&state->cc, state->e);
+    break;
+OPCODE(0x1d)  // DCR E    E <- E-1
+    state->e--;
+    SetFlagsNoCarry(&state->cc, state->e);
+    break;
+OPCODE(0x1e)  // MVI E, D8    E <- byte2
+    state->e = opcode[1];
+    state->pc++;
+    break;
+OPCODE(0x1f)  // RAR      A = A >> 1; bit 7 = prev cy; CY = prev bit 0
+{
+    uint8_t a = state->a;
+    state->a = (state->cc.cy << 7) | (a >> 1);
+    state->cc.cy = a & 1;
+}
+    break;
+OPCODE(0x20)  // NOP
+    break;
+OPCODE(0x21)  // LXI H, D16   H <- byte 3, L <- byte 2
+    state->hl = (opcode[2] << 8) | opcode[1];
+    state->pc += 2;
+    break;
+OPCODE(0x22)  // 	SHLD adr    (adr) <-L; (adr+1)<-H
+{
+    uint16_t address = (opcode[2] << 8) | opcode[1];
+    WRITE_MEM(state, address, state->l);
+    WRITE_MEM(state, address + 1, state->h);
+    state->pc += 2;
+}
+    break;
+OPCODE(0x23)  // INX H 	HL <- HL+1
+    state->hl++;
+    break;
+OPCODE(0x24)  // INR H	H <- H+1
+    state->h++;
+    SetFlagsNoCarry(&state->cc, state->h);
+    break;
+OPCODE(0x25)  // DCR H    H <- H-1
+    state->h--;
+    SetFlagsNoCarry(&state->cc, state->h);
+    break;
+OPCODE(0x26)  // MVI H, D8    H <- byte2
+    state->h = opcode[1];
+    state->pc++;
+    break;
+OPCODE(0x27)  // DAA special
+    if ((state->a & 0xf) > 9)
+        state->a += 6;
+    if ((state->a & 0xf0) > 0x90)
+    {
+        uint16_t answer = (uint16_t) state->a + 0x60;
+        state->a = answer & 0xff;
+        SetFlags(&state->cc, answer);
+    }
+    break;
+OPCODE(0x28)  // NOP
+    break;
+OPCODE(0x29)  // DAD H    HL = HL + HL?
+{
+    uint32_t hl = (uint32_t) state->hl + state->hl;
+    state->hl = hl & 0xffff;
+    state->cc.cy = (hl > 0xffff);   // only set carry
+}
+    break;
+OPCODE(0x2a)  // LHLD adr L <- (adr); H <- (adr + 1)
+{
+    uint16_t address = (opcode[2] << 8) | opcode[1];
+    state->l = READ_MEM(state, address);
+    state->h = READ_MEM(state, address + 1);
+    state->pc += 2;
+}
+    break;
+OPCODE(0x2b)  // DCX H    HL = HL - 1
+    state->hl--;
+    break;
+OPCODE(0x2c)  // INR L	L <- L+1
+    state->l++;
+    SetFlagsNoCarry(&state->cc, state->l);
+    break;
+OPCODE(0x2d)  // DCR L    L <- L-1
+    state->l--;
+    SetFlagsNoCarry(&state->cc, state->l);
+    break;
+OPCODE(0x2e)  // MVI L, D8    L <- byte2
+    state->l = opcode[1];
+    state->pc++;
+    break;
+OPCODE(0x2f)  // CMA  not  (A<-!A)
+    state->a = ~state->a;
+    break;
+OPCODE(0x30)  // NOP
+    break;
+OPCODE(0x31)  // LXI SP, D16  SP.hi <- byte 3, SP.lo <- byte 2
+{
+    uint16_t address = (opcode[2] << 8) | opcode[1];
+    state->sp = address;
+    state->pc += 2;
+}
+    break;
+OPCODE(0x32)  // STA adr  (adr) <- A
+{
+
+    uint16_t address = (opcode[2] << 8) | opcode[1];
+    WRITE_MEM(state, address, state->a);
+    state->pc += 2;
+}
+    break;
+OPCODE(0x33)  // INX SP   SP = SP + 1
+    state->sp++;
+    break;
+OPCODE(0x34)  // INR M    (HL) <- (HL) + 1
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, READ_MEM(state, address) + 1);
+    SetFlagsNoCarry(&state->cc, READ_MEM(state, address));
+}
+    break;
+OPCODE(0x35)  // DCR M    (HL) <- (HL) - 1
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, READ_MEM(state, address) - 1);
+    SetFlagsNoCarry(&state->cc, READ_MEM(state, address));
+}
+    break;
+OPCODE(0x36)  // MVI M, D8    (HL) <- byte2
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, opcode[1]);
+    state->pc++;
+}
+    break;
+OPCODE(0x37)  // STC      CY = 1
+    state->cc.cy = 1;
+    break;
+OPCODE(0x38)  // NOP
+    break;
+OPCODE(0x39)  // DAD SP   HL = HL + SP
+{
+    uint32_t hl = (uint32_t) state->hl + state->sp;
+    state->hl = hl & 0xffff;
+    state->cc.cy = (hl > 0xffff);   // only set carry
+}
+    break;
+OPCODE(0x3a)  // LDA adr  A <- (adr)
+{
+
+    uint16_t address = (opcode[2] << 8) | opcode[1];
+    state->a = READ_MEM(state, address);
+    state->pc += 2;
+}
+    break;
+OPCODE(0x3b)  // DCX SP   SP = SP - 1
+    state->sp--;
+    break;
+OPCODE(0x3c)  // INR A	A <- A+1
+    state->a++;
+    SetFlagsNoCarry(&state->cc, state->a);
+    break;
+OPCODE(0x3d)  // DCR A    A <- A-1
+    state->a--;
+    SetFlagsNoCarry(&state->cc, state->a);
+    break;
+OPCODE(0x3e)  // MVI A, D8    A <- byte2
+    state->a = opcode[1];
+    state->pc++;
+    break;
+OPCODE(0x3f)  // CMC  not  (CY<-!CY)
+    state->cc.cy = ~state->cc.cy;
+    break;
+OPCODE(0x40)  // MOV B, B     B <- B
+    state->b = state->b;
+    break;
+OPCODE(0x41)  // MOV B, C
+    state->b = state->c;
+    break;
+OPCODE(0x42)  // MOV B, D
+    state->b = state->d;
+    break;
+OPCODE(0x43)  // MOV B, E
+    state->b = state->e;
+    break;
+OPCODE(0x44)  // MOV B, H
+    state->b = state->h;
+    break;
+OPCODE(0x45)  // MOV B, L
+    state->b = state->l;
+    break;
+OPCODE(0x46)  // MOV B, M     B <- (HL)
+{
+    uint16_t address = state->hl;
+    state->b = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x47)  // MOV B, A
+    state->b = state->a;
+    break;
+OPCODE(0x48)  // MOV C, B     C <- B
+    state->c = state->b;
+    break;
+OPCODE(0x49)  // MOV C, C
+    state->c = state->c;
+    break;
+OPCODE(0x4a)  // MOV C, D
+    state->c = state->d;
+    break;
+OPCODE(0x4b)  // MOV C, E
+    state->c = state->e;
+    break;
+OPCODE(0x4c)  // MOV C, H
+    state->c = state->h;
+    break;
+OPCODE(0x4d)  // MOV C, L
+    state->c = state->l;
+    break;
+OPCODE(0x4e)  // MOV C, M     C <- (HL)
+{
+    uint16_t address = state->hl;
+    state->c = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x4f)  // MOV C, A
+    state->c = state->a;
+    break;
+OPCODE(0x50)  // MOV D, B
+    state->d = state->b;
+    break;
+OPCODE(0x51)  // MOV D, C
+    state->d = state->c;
+    break;
+OPCODE(0x52)  // MOV D, D
+    state->d = state->d;
+    break;
+OPCODE(0x53)  // MOV D, E
+    state->d = state->e;
+    break;
+OPCODE(0x54)  // MOV D, H
+    state->d = state->h;
+    break;
+OPCODE(0x55)  // MOV D, L
+    state->d = state->l;
+    break;
+OPCODE(0x56)  // MOV D, M
+{
+    uint16_t address = state->hl;
+    state->d = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x57)  // MOV D, A
+    state->d = state->a;
+    break;
+OPCODE(0x58)  // MOV E, B
+    state->e = state->b;
+    break;
+OPCODE(0x59)  // MOV E, C
+    state->e = state->c;
+    break;
+OPCODE(0x5a)  // MOV E, D
+    state->e = state->d;
+    break;
+OPCODE(0x5b)  // MOV E, E
+    state->e = state->e;
+    break;
+OPCODE(0x5c)  // MOV E, H
+    state->e = state->h;
+    break;
+OPCODE(0x5d)  // MOV E, L
+    state->e = state->l;
+    break;
+OPCODE(0x5e)  // MOV E, M
+{
+    uint16_t address = state->hl;
+    state->e = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x5f)  // MOV E, A
+    state->e = state->a;
+    break;
+OPCODE(0x60)  // MOV H, B
+    state->h = state->b;
+    break;
+OPCODE(0x61)  // MOV H, C
+    state->h = state->c;
+    break;
+OPCODE(0x62)  // MOV H, D
+    state->h = state->d;
+    break;
+OPCODE(0x63)  // MOV H, E
+    state->h = state->e;
+    break;
+OPCODE(0x64)  // MOV H, H
+    state->h = state->h;
+    break;
+OPCODE(0x65)  // MOV H, L
+    state->h = state->l;
+    break;
+OPCODE(0x66)  // MOV H, M
+{
+    uint16_t address = state->hl;
+    state->h = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x67)  // MOV H, A
+    state->h = state->a;
+    break;
+OPCODE(0x68)  // MOV L, B
+    state->l = state->b;
+    break;
+OPCODE(0x69)  // MOV L, C
+    state->l = state->c;
+    break;
+OPCODE(0x6a)  // MOV L, D
+    state->l = state->d;
+    break;
+OPCODE(0x6b)  // MOV L, E
+    state->l = state->e;
+    break;
+OPCODE(0x6c)  // MOV L, H
+    state->l = state->h;
+    break;
+OPCODE(0x6d)  // MOV L, L
+    state->l = state->l;
+    break;
+OPCODE(0x6e)  // MOV L, M
+{
+    uint16_t address = state->hl;
+    state->l = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x6f)  // MOV L, A
+    state->l = state->a;
+    break;
+OPCODE(0x70)  // MOV M, B
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, state->b);
+    break;
+}
+OPCODE(0x71)  // MOV M, C
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, state->c);
+    break;
+}
+OPCODE(0x72)  // MOV M, D
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, state->d);
+    break;
+}
+OPCODE(0x73)  // MOV M, E
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, state->e);
+    break;
+}
+OPCODE(0x74)  // MOV M, H
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, state->h);
+    break;
+}
+OPCODE(0x75)  // MOV M, L
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, state->l);
+    break;
+}
+OPCODE(0x76)  // HLT special
+    // The CPU stops here until an interrupt: pc stays on the HLT. The machine cores hand
+    // HLT to their caller before running it, which halts the machine.
+    state->pc -= 1;
+    break;
+OPCODE(0x77)  // MOV M, A
+{
+    uint16_t address = state->hl;
+    WRITE_MEM(state, address, state->a);
+}
+    break;
+OPCODE(0x78)  // MOV A, B     A <- B
+    state->a = state->b;
+    break;
+OPCODE(0x79)  // MOV A, C
+    state->a = state->c;
+    break;
+OPCODE(0x7a)  // MOV A, D
+    state->a = state->d;
+    break;
+OPCODE(0x7b)  // MOV A, E
+    state->a = state->e;
+    break;
+OPCODE(0x7c)  // MOV A, H
+    state->a = state->h;
+    break;
+OPCODE(0x7d)  // MOV A, L
+    state->a = state->l;
+    break;
+OPCODE(0x7e)  // MOV A, M     A <- (HL)
+{
+    uint16_t address = state->hl;
+    state->a = READ_MEM(state, address);
+}
+    break;
+OPCODE(0x7f)  // MOV A, A
+    state->a = state->a;
+    break;
+OPCODE(0x80)  // ADD B
+{
+    // store result in 16 bit answer to check for carry
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->b;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;   // remove extra 8 bits
+}
+    break;
+OPCODE(0x81)  // ADD C
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->c;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x82)  // ADD D
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->d;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x83)  // ADD E
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->e;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x84)  // ADD H
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->h;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x85)  // ADD L
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->l;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x86)  // ADD M
+{
+    // M is the byte pointed to by address stored in HL
+    uint16_t address = state->hl;
+    uint16_t answer = (uint16_t) state->a + READ_MEM(state, address);
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x87)  // ADD A
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->a;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x88)  // 	ADC B
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->b + state->cc.cy;;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x89)   // ADC C
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->c + state->cc.cy;;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x8a)   // ADC D
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->d + state->cc.cy;;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x8b)  // ADC E
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->e + state->cc.cy;;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x8c)  // ADC H
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->h + state->cc.cy;;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x8d)  // ADC L
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->l + state->cc.cy;;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x8e)  // ADC M
+{
+    uint16_t address = state->hl;
+    uint16_t answer = (uint16_t) state->a + READ_MEM(state, address) + state->cc.cy;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x8f)  // ADC A
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) state->a + state->cc.cy;;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+}
+    break;
+OPCODE(0x90)  // SUB B
+{
+    state->cc.cy = state->a < state->b;
+    state->a  -= state->b;
+    SetFlagsNoCarry(&state->cc, state->a);
+}
+    break;
+OPCODE(0x91)  // SUB C
+{
+    state->cc.cy = state->a < state->c;
+    state->a  -= state->c;
+    SetFlagsNoCarry(&state->cc, state->a);
+}
+    break;
+OPCODE(0x92)  // SUB D
+{
+    state->cc.cy = state->a < state->d;
+    state->a  -= state->d;
+    SetFlagsNoCarry(&state->cc, state->a);
+}
+    break;
+OPCODE(0x93)  // SUB E
+{
+    state->cc.cy = state->a < state->e;
+    state->a  -= state->e;
+    SetFlagsNoCarry(&state->cc, state->a);
+}
+    break;
+OPCODE(0x94)  // SUB H
+{
+    state->cc.cy = state->a < state->h;
+    state->a  -= state->h;
+    SetFlagsNoCarry(&state->cc, state->a);
+}
+    break;
+OPCODE(0x95)  // SUB L
+{
+    state->cc.cy = state->a < state->l;
+    state->a  -= state->l;
+    SetFlagsNoCarry(&state->cc, state->a);
+}
+    break;
+OPCODE(0x96)  // SUB M
+{
+    // M is the byte pointed to by SUBress stored in HL
+    uint16_t address = state->hl;
+    state->cc.cy = state->a < READ_MEM(state, address);
+    state->a  -= READ_MEM(state, address);
+    SetFlagsNoCarry(&state->cc, state->a);
+}
+    break;
+OPCODE(0x97)  // SUB A
+{
+    state->cc.cy = 0;
+    state->a  -= state->a;
+    SetFlagsNoCarry(&state->cc, state->a);
+}
+    break;
+OPCODE(0x98)  // SBB B
+    SBB_Register(state->b, state);
+    break;
+OPCODE(0x99)  // SBB C
+    SBB_Register(state->c, state);
+    break;
+OPCODE(0x9a)  // SBB D
+    SBB_Register(state->d, state);
+    break;
+OPCODE(0x9b)  // SBB E
+    SBB_Register(state->e, state);
+    break;
+OPCODE(0x9c)  // SBB H
+    SBB_Register(state->h, state);
+    break;
+OPCODE(0x9d)  // SBB L
+    SBB_Register(state->l, state);
+    break;
+OPCODE(0x9e)  // SBB M
+{
+    uint16_t address = state->hl;
+    SBB_Register(READ_MEM(state, address), state);
+}
+    break;
+OPCODE(0x9f)  // SBB A
+    SBB_Register(state->a, state);
+    break;
+OPCODE(0xa0)  // ANA B   (A <-A & B)
+    state->a &= state->b;
+    SetFlagsLogic(&state->cc, state->a); // AND always clears CY
+    break;
+OPCODE(0xa1)  // ANA C   (A <-A & C)
+    state->a &= state->c;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xa2)  // ANA D   (A <-A & D)
+    state->a &= state->d;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xa3)  // ANA E   (A <-A & E)
+    state->a &= state->e;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xa4)  // ANA H   (A <-A & H)
+    state->a &= state->h;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xa5)  // ANA L   (A <-A & L)
+    state->a &= state->l;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xa6)  // ANA M   (A <-A & (HL))
+{
+    uint16_t address = state->hl;
+    state->a &= READ_MEM(state, address);
+    SetFlagsLogic(&state->cc, state->a);
+}
+    break;
+OPCODE(0xa7)  // ANA A   (A <-A & A)
+    // Don't need to update A because A & A doesn't change A
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xa8)  // XRA B   (A <-A ^ B)
+    state->a ^= state->b;
+    SetFlagsLogic(&state->cc, state->a); // AND always clears CY
+    break;
+OPCODE(0xa9)  // XRA C   (A <-A ^ C)
+    state->a ^= state->c;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xaa)  // XRA D   (A <-A ^ D)
+    state->a ^= state->d;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xab)  // XRA E   (A <-A ^ E)
+    state->a ^= state->e;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xac)  // XRA H   (A <-A ^ H)
+    state->a ^= state->h;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xad)  // XRA L   (A <-A ^ L)
+    state->a ^= state->l;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xae)  // XRA M   (A <-A ^ (HL))
+{
+    uint16_t address = state->hl;
+    state->a ^= READ_MEM(state, address);
+    SetFlagsLogic(&state->cc, state->a);
+}
+    break;
+OPCODE(0xaf)  // XRA A   (A <-A ^ A)
+    state->a = 0;   // xor itself is always 0
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xb0)  // ORA B   (A <-A | B)
+    state->a |= state->b;
+    SetFlagsLogic(&state->cc, state->a); // AND always clears CY
+    break;
+OPCODE(0xb1)  // ORA C   (A <-A | C)
+    state->a |= state->c;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xb2)  // ORA D   (A <-A | D)
+    state->a |= state->d;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xb3)  // ORA E   (A <-A | E)
+    state->a |= state->e;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xb4)  // ORA H   (A <-A | H)
+    state->a |= state->h;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xb5)  // ORA L   (A <-A | L)
+    state->a |= state->l;
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xb6)  // ORA M   (A <-A | (HL))
+{
+    uint16_t address = state->hl;
+    state->a |= READ_MEM(state, address);
+    SetFlagsLogic(&state->cc, state->a);
+}
+    break;
+OPCODE(0xb7)  // ORA A   (A <-A | A)
+    // Don't need to update A because A | A doesn't change A
+    SetFlagsLogic(&state->cc, state->a);
+    break;
+OPCODE(0xb8)  // CMP B    (A - B)
+{
+    SetFlagsNoCarry(&state->cc, state->a - state->b);
+    state->cc.cy = state->a < state->b;
+}
+    break;
+OPCODE(0xb9)  // CMP C    (A - C)
+{
+    SetFlagsNoCarry(&state->cc, state->a - state->c);
+    state->cc.cy = state->a < state->c;
+}
+    break;
+OPCODE(0xba)  // CMP D    (A - D)
+{
+    SetFlagsNoCarry(&state->cc, state->a - state->d);
+    state->cc.cy = state->a < state->d;
+}
+    break;
+OPCODE(0xbb)  // CMP E    (A - E)
+{
+    SetFlagsNoCarry(&state->cc, state->a - state->e);
+    state->cc.cy = state->a < state->e;
+}
+    break;
+OPCODE(0xbc)  // CMP H    (A - H)
+{
+    SetFlagsNoCarry(&state->cc, state->a - state->h);
+    state->cc.cy = state->a < state->h;
+}
+    break;
+OPCODE(0xbd)  // CMP L    (A - L)
+{
+    SetFlagsNoCarry(&state->cc, state->a - state->l);
+    state->cc.cy = state->a < state->l;
+}
+    break;
+OPCODE(0xbe)  // CMP M    (A - (HL))
+{
+    uint16_t address = state->hl;
+    SetFlagsNoCarry(&state->cc, state->a - READ_MEM(state, address));
+    state->cc.cy = state->a < READ_MEM(state, address);
+}
+    break;
+OPCODE(0xbf)  // CMP A    (A - A)
+    SetFlagsLogic(&state->cc, 0);    // A - A is always 0
+    break;
+OPCODE(0xc0)  // RNZ adr  (if NZ, RET)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.z == 0)
+    {
+        Return(state);
+        cycles += 6;    // taken
+    }
+    break;
+OPCODE(0xc1)  // POP B    C <- (sp); B <- (sp+1); sp <- sp+2
+{
+    state->c = READ_MEM(state, state->sp);
+    state->b = READ_MEM(state, state->sp+1);
+    state->sp += 2;
+}
+    break;
+OPCODE(0xc2)  // JNZ adr  (if NZ, PC <- adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.z == 0)
+            state->pc = (opcode[2] << 8) | opcode[1];
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xc3)  // JMP adr  (PC <- adr)
+    state->pc = (opcode[2] << 8) | opcode[1];
+    break;
+OPCODE(0xc4)  // CNZ adr  (if NZ, CALL adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.z == 0)
+    {
+        CallAdr(state, opcode);
+        cycles += 6;    // taken
+    }
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xc5)  // PUSH B    (sp-2)<-C; (sp-1)<-B; sp <- sp - 2
+{
+    WRITE_MEM(state, state->sp-1, state->b);
+    WRITE_MEM(state, state->sp-2, state->c);
+    state->sp = state->sp - 2;
+}
+    break;
+OPCODE(0xc6)  // ADI D8 (A <- A + byte)
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) opcode[1];
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+    state->pc++;
+}
+    break;
+OPCODE(0xc7)  // RST 0    (CALL $0)
+    CallConstantAdr(state, 0);
+    break;
+OPCODE(0xc8)  // RZ adr  (if Z, RET)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.z)
+    {
+        Return(state);
+        cycles += 6;    // taken
+    }
+    break;
+OPCODE(0xc9)  // RET      (PC.lo <- (sp); PC.hi<-(sp+1); SP <- SP+2)
+    Return(state);
+    break;
+OPCODE(0xca)  // JZ adr   (if Z, PC <- adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.z)
+        state->pc = (opcode[2] << 8) | opcode[1];
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xcb)  // NOP
+    break;
+OPCODE(0xcc)  // CZ adr  (if Z, CALL adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.z)
+    {
+        CallAdr(state, opcode);
+        cycles += 6;    // taken
+    }
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xcd)  // CALL adr ((SP-1)<-PC.hi;(SP-2)<-PC.lo;SP<-SP-2;PC=adr)
+    CallAdr(state, opcode);
+    break;
+OPCODE(0xce)  // ACI D8 (A <- A + data + CY)
+{
+    uint16_t answer = (uint16_t) state->a + (uint16_t) opcode[1] + state->cc.cy;
+    SetFlags(&state->cc, answer);
+    state->a = answer & 0xff;
+    state->pc++;
+}
+    break;
+OPCODE(0xcf)  // RST 1    (CALL $8)
+    CallConstantAdr(state, 8);
+    break;
+OPCODE(0xd0)  // RNC adr  (if NCY, RET)
+    if (state->cc.cy == 0)
+    {
+        Return(state);
+        cycles += 6;    // taken
+    }
+    break;
+OPCODE(0xd1)  // POP D    E <- (sp); D <- (sp+1); sp <- sp+2
+{
+    state->e = READ_MEM(state, state->sp);
+    state->d = READ_MEM(state, state->sp+1);
+    state->sp += 2;
+}
+    break;
+OPCODE(0xd2)  // JNC adr  (if NCY, PC <- adr)
+    if (state->cc.cy == 0)
+        state->pc = (opcode[2] << 8) | opcode[1];
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xd3)  // OUT D8    special
+    state->pc++;
+    break;
+OPCODE(0xd4)  // CNC adr  (if NCY, CALL adr)
+    if (state->cc.cy == 0)
+    {
+        CallAdr(state, opcode);
+        cycles += 6;    // taken
+    }
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xd5)  // PUSH D    (sp-2)<-E; (sp-1)<-D; sp <- sp - 2
+{
+    WRITE_MEM(state, state->sp-1, state->d);
+    WRITE_MEM(state, state->sp-2, state->e);
+    state->sp = state->sp - 2;
+}
+    break;
+OPCODE(0xd6)  // SUI D8 (A <- A - data)
+{
+    state->cc.cy = (state->a < opcode[1]);
+    state->a -= opcode[1];
+    SetFlagsNoCarry(&state->cc, state->a);
+
+    state->pc++;
+}
+    break;
+OPCODE(0xd7)  // RST 2    (CALL $10)
+    CallConstantAdr(state, 10);
+    break;
+OPCODE(0xd8)  // RC adr  (if CY, RET)
+    if (state->cc.cy)
+    {
+        Return(state);
+        cycles += 6;    // taken
+    }
+    break;
+OPCODE(0xd9)  // NOP
+    break;
+OPCODE(0xda)  // JC adr  (if CY, PC <- adr)
+    if (state->cc.cy)
+        state->pc = (opcode[2] << 8) | opcode[1];
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xdb)  // IN D8    special
+    state->pc++;
+    break;
+OPCODE(0xdc)  // CC adr  (if CY, CALL adr)
+    if (state->cc.cy)
+    {
+        CallAdr(state, opcode);
+        cycles += 6;    // taken
+    }
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xdd)  // NOP
+    break;
+OPCODE(0xde)  // SBI D8   A <- A - data - CY
+{
+    uint16_t answer = (uint16_t) state->a - (uint16_t) opcode[1] - state->cc.cy;
+    SetFlagsNoCarry(&state->cc, answer);
+    state->cc.cy = (state->a < (opcode[1] + state->cc.cy));
+    state->a = answer & 0xff;
+    state->pc++;
+}
+    break;
+OPCODE(0xdf)  // RST 3    (CALL $18)
+    CallConstantAdr(state, 18);
+    break;
+OPCODE(0xe0)  // RPO  (if PO, RET)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.p == 0)
+    {
+        Return(state);
+        cycles += 6;    // taken
+    }
+    break;
+OPCODE(0xe1)  // POP B    L <- (sp); H <- (sp+1); sp <- sp+2
+{
+    state->l = READ_MEM(state, state->sp);
+    state->h = READ_MEM(state, state->sp+1);
+    state->sp += 2;
+}
+    break;
+OPCODE(0xe2)  // JPO  (if PO, PC <- adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.p == 0)
+        state->pc = (opcode[2] << 8) | opcode[1];
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xe3)  // XTHL 	L <-> (SP); H <-> (SP+1)
+{
+    uint8_t temp = state->l;
+    state->l = READ_MEM(state, state->sp);
+    WRITE_MEM(state, state->sp, temp);
+
+    temp = state->h;
+    state->h = READ_MEM(state, state->sp + 1);
+    WRITE_MEM(state, state->sp + 1, temp);
+}
+    break;
+OPCODE(0xe4)  // CPO adr  (if PO, CALL adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.p == 0)
+    {
+        CallAdr(state, opcode);
+        cycles += 6;    // taken
+    }
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xe5)  // PUSH H    (sp-2)<-L; (sp-1)<-H; sp <- sp - 2
+{
+    WRITE_MEM(state, state->sp-1, state->h);
+    WRITE_MEM(state, state->sp-2, state->l);
+    state->sp = state->sp - 2;
+}
+    break;
+OPCODE(0xe6)  // ANI D8   (A <-A & data)
+    state->a &= opcode[1];
+    SetFlagsLogic(&state->cc, state->a); // ANI always clears CY
+    state->pc++;
+    break;
+OPCODE(0xe7)  // RST 4    (CALL $20)
+    CallConstantAdr(state, 20);
+    break;
+OPCODE(0xe8)  // RPE  (if PE, RET)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.p)
+    {
+        Return(state);
+        cycles += 6;    // taken
+    }
+    break;
+OPCODE(0xe9)  // PCHL (PC.hi <- H; PC.lo <- L)
+    state->pc = state->hl;
+    break;
+OPCODE(0xea)  // JPE  (if PE, PC <- adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.p)
+        state->pc = (opcode[2] << 8) | opcode[1];
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xeb)  // XCHG 	H <-> D; L <-> E
+{
+    uint16_t temp = state->hl;
+    state->hl = state->de;
+    state->de = temp;
+}
+    break;
+OPCODE(0xec)  // CPE adr  (if PE, CALL adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.p)
+    {
+        CallAdr(state, opcode);
+        cycles += 6;    // taken
+    }
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xed)  // NOP
+    break;
+OPCODE(0xee)  // XRI D8   A <- A ^ data
+    state->a ^= opcode[1];
+    SetFlagsLogic(&state->cc, state->a);
+    state->pc++;
+    break;
+OPCODE(0xef)  // RST 5    (CALL $28)
+    CallConstantAdr(state, 28);
+    break;
+OPCODE(0xf0)  // RP plus sign  (if P, RET)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.s == 0)
+    {
+        Return(state);
+        cycles += 6;    // taken
+    }
+    break;
+OPCODE(0xf1)  // POP PSW   flags <- (sp); A <- (sp+1); sp <- sp+2
+{
+    MATERIALIZE_ZSP(state);
+    state->a = READ_MEM(state, state->sp+1);
+    // Low 5 bits store each flag ac-cy-p-s-z, same layout as cc.psw
+    state->cc.psw = READ_MEM(state, state->sp) & PSW_FLAGS;
+    state->sp += 2;
+}
+    break;
+OPCODE(0xf2)  // JP plus for sign (if P, PC <- adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.s == 0)
+        state->pc = (opcode[2] << 8) | opcode[1];
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xf3)  // DI   special disable interrupt
+    state->int_enable = 0;
+    break;
+OPCODE(0xf4)  // CP adr plus sign  (if PO, CALL adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.s == 0)
+    {
+        CallAdr(state, opcode);
+        cycles += 6;    // taken
+    }
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xf5)  // PUSH PSW  (sp-2)<-flags; (sp-1)<-A; sp <- sp - 2
+{
+    MATERIALIZE_ZSP(state);
+    WRITE_MEM(state, state->sp-1, state->a);
+    // Low 5 bits store each flag ac-cy-p-s-z, same layout as cc.psw
+    state->sp -= 2;
+    WRITE_MEM(state, state->sp, state->cc.psw & PSW_FLAGS);
+}
+    break;
+OPCODE(0xf6)  // ORI D8   A <- A | data
+    state->a |= opcode[1];
+    SetFlagsLogic(&state->cc, state->a);
+    state->pc++;
+    break;
+OPCODE(0xf7)  // RST 6    (CALL $30)
+    CallConstantAdr(state, 30);
+    break;
+OPCODE(0xf8)  // RM minus sign  (if M, RET)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.s)
+    {
+        Return(state);
+        cycles += 6;    // taken
+    }
+    break;
+OPCODE(0xf9)  // SPHL SP=HL
+    state->sp = state->hl;
+    break;
+OPCODE(0xfa)  // JM minus for sign (if M, PC <- adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.s)
+        state->pc = (opcode[2] << 8) | opcode[1];
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xfb)  // EI   special enable interrupt
+    state->int_enable = 1;
+    break;
+OPCODE(0xfc)  // CM adr minus sign  (if M, CALL adr)
+    MATERIALIZE_ZSP(state);
+    if (state->cc.s)
+    {
+        CallAdr(state, opcode);
+        cycles += 6;    // taken
+    }
+    else
+        state->pc += 2;
+    break;
+OPCODE(0xfd)  // NOP
+    break;
+OPCODE(0xfe)  // CPI D8   (A - data)
+{
+    SetFlagsNoCarry(&state->cc, state->a - opcode[1]);
+    state->cc.cy = (state->a < opcode[1]);
+    state->pc++;
+}
+    break;
+OPCODE(0xff)  // RST 7    (CALL $38)
+    CallConstantAdr(state, 38);
+    break;
@@ -0,0 +1,74 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "romset.h"
+#include "runner.h"
+
+// Single-machine benchmark, no SDL: plays --frames N frames (default 6000) of the runner's
+// input script on one thread, --repeat N times (default 5) on a fresh machine each time,
+// and prints each run and the fastest. Build it with and without a build option (e.g.
+// LAZY_FLAGS) and compare the best lines; the checksum has to be the same in both builds.
+int main(int argc, char**argv)
+{
+    Core core = CORE_BATCH;
+    int check_crc = 1;
+    int repeat = 5;
+    long frames = 6000;
+    uint64_t seed = 1;
+    const char* rom_directory = "../Rom";
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-crc") == 0) check_crc = 0;
+        if (strcmp(argv[i], "--rom-dir") == 0 && i + 1 < argc) rom_directory = argv[++i];
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frames = strtol(argv[++i], NULL, 10);
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = atoi(argv[++i]);
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        if (strcmp(argv[i], "--core") == 0 && i + 1 < argc && ParseCoreName(argv[++i], &core) != 0) return 1;
+    }
+    if (frames < 1 || frames > INT_MAX || repeat < 1)
+    {
+        printf("error: Need 1-%d frames and at least one run\n", INT_MAX);
+        return 1;
+    }
+
+    RomSet rom;
+    if (LoadRomSet(&rom, rom_directory, check_crc) != 0) return 1;
+
+#ifdef LAZY_FLAGS
+    const char* flags = "lazy";
+#else
+    const char* flags = "eager";
+#endif
+    printf("%ld frames, %s flags\n", frames, flags);
+    printf("run    seconds      MHz     frames/s   M instr/s  checksum\n");
+    double best = 0.0;
+    uint64_t cycles = 0, instructions = 0;
+    for (int run = 1; run <= repeat; run++)
+    {
+        Runner* runner = NewRunner(&rom, core, 1, seed, 0);
+        double seconds = RunInstances(runner, frames, (int) frames, 1);
+        if (seconds < 0.0)
+        {
+            FreeRunner(runner);
+            UnloadRomSet(&rom);
+            return 1;
+        }
+        Machine* machine = runner->instances[0].machine;
+        cycles = machine->scheduler.now;
+        instructions = machine->state.instructions;
+        uint32_t checksum = RunnerChecksum(runner);
+        FreeRunner(runner);
+
+        if (best == 0.0 || seconds < best) best = seconds;
+        printf("%3d %10.3f %8.2f %12.1f %11.2f  %08x\n", run, seconds, cycles / seconds / 1e6,
+               frames / seconds, instructions / seconds / 1e6, checksum);
+    }
+    printf("best %9.3f %8.2f %12.1f %11.2f\n", best, cycles / best / 1e6, frames / best,
+           instructions / best / 1e6);
+
+    UnloadRomSet(&rom);
+    return 0;
+}
@@ -1,193 +1,354 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
 
 #include <SDL2/SDL.h>
 
-#include "8080emulator.h"
-#include "ports.h"
+#include "machine.h"
 #include "sound.h"
 #include "input.h"
 #include "graphics.h"
+#include "profiler.h"
+#include "romset.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "movie.h"
 
-void ReadFileMem(State8080* state, char* filename, uint32_t mem_address)
-{
-    FILE *f= fopen(filename, "rb");
-    if (f==NULL)
-    {
-        printf("error: Couldn't open %s\n", filename);
-        exit(1);
-    }
-    fseek(f, 0L, SEEK_END);
-    int file_size = ftell(f);
-    fseek(f, 0L, SEEK_SET);
+#define PROFILE_TOP         40      // addresses listed in the --profile report
+#define REWIND_BYTES        (16 << 20)      // history budget, several minutes of play
+#define REWIND_FRAMES       (60 * 60 * 10)  // never more than 10 minutes
 
-    uint8_t *buffer = &state->memory[mem_address];
-    fread(buffer, file_size, 1, f);
-    fclose(f);
-}
+// What the machine hooks reach
+typedef struct Frontend {
+    Mixer*      mixer;
+    Video*      video;
+} Frontend;
 
+// Machine hooks, on the emulation thread
+void SoundHook(void* user, int port, uint8_t old_bits, uint8_t bits, uint64_t when)
+{
+    Frontend* frontend = user;
+    PlaySounds(frontend->mixer, port, old_bits, bits, when);
+}
 
-void InitPorts(Ports* ports)
+void ScreenHook(void* user, Machine* machine, int half)
 {
-    ports->input0 = 0b00001110; // Bits 1, 2, 3 are always 1; other inputs are default 0.
-    ports->input1 = 0b00001000; // Bit 3 is always 1; all others default to 0.
-    ports->input2 = 0b00000000;
-
-    ports->shift_register = 0x0000;
-    ports->shift_amount = 0;
-    ports->output2 = 0;
-    ports->output3 = 0;
-    ports->output5 = 0;
-    ports->output6 = 0;
+    Frontend* frontend = user;
+    draw_screen(&machine->state, frontend->video, half);
 }
 
-void MachineIN(uint8_t port, Ports* ports, State8080* state)
+// Optional wall-clock layer on top of the cycle timing: sleeps so frames come out at 60 Hz
+typedef struct Pacer {
+    Uint64  next_frame;         // performance counter value the next frame is due at
+    Uint64  ticks_per_frame;
+} Pacer;
+
+void InitPacer(Pacer* pacer)
 {
-    switch (port) {
-        case 0:
-            state->a = ports->input0;
-            break;
-        case 1:
-            state->a = ports->input1;
-            break;
-        case 2:
-            state->a = ports->input2;
-            break;
-        case 3:
-            // read shift register with shifted amount
-            state->a = ((ports->shift_register >> (8 - ports->shift_amount)) & 0xff);
-            break;
-        default:
-            break;
-    }
+    pacer->ticks_per_frame = SDL_GetPerformanceFrequency() / 60;
+    pacer->next_frame = SDL_GetPerformanceCounter() + pacer->ticks_per_frame;
 }
-void MachineOUT(uint8_t port, Ports* ports, State8080* state)
+
+void PaceFrame(Pacer* pacer)
 {
-    switch (port) {
-        case 2:
-            ports->shift_amount = state->a & 0x7;
-            break;
-        case 3:
-            ports->output3 = state->a;
-            break;
-        case 4:
-            // shift register moves left half to right side, and place new value on left side
-            ports->shift_register = (state->a << 8) | (ports->shift_register >> 8);
-            break;
-        case 5:
-            ports->output5 = state->a;
-            break;
-        case 6:
-            ports->output6 = state->a;
-            break;
-        default:
-            break;
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (now < pacer->next_frame)
+    {
+        Uint64 ms = (pacer->next_frame - now) * 1000 / SDL_GetPerformanceFrequency();
+        if (ms > 0) SDL_Delay((Uint32) ms);
     }
+    // More than a few frames behind (debugger, window drag): catch up instead of racing
+    else if (now - pacer->next_frame > 4 * pacer->ticks_per_frame)
+        pacer->next_frame = now;
+    pacer->next_frame += pacer->ticks_per_frame;
 }
 
-void GenerateInterrupt(State8080* state, int interrupt_num)
+// Quick save and load, asked for by the main thread and done between frames
+enum { SNAPSHOT_NONE, SNAPSHOT_SAVE, SNAPSHOT_LOAD };
+
+// Everything the emulation thread needs. The main thread only touches the atomics:
+// it clears running to stop the thread, stores the input port bits from key events,
+// posts snapshot requests and holds rewinding while the rewind key is down.
+typedef struct Emulation {
+    Machine*        machine;
+    Video*          video;
+    Movie*          movie;                      // being recorded, or NULL
+    int             throttle;
+    int             has_quick_save;
+    uint8_t         quick_save[SNAPSHOT_SIZE];
+    Rewind          rewind;                     // a snapshot of every frame
+    uint8_t         frame[SNAPSHOT_SIZE];
+    atomic_int      running;
+    atomic_uchar    input1;
+    atomic_uchar    input2;
+    atomic_int      snapshot_request;
+    atomic_int      rewinding;
+} Emulation;
+
+// Runs frames until the main thread clears running, or until the CPU halts. Frames go
+// to the renderer through the frame ring, so a slow present never holds the CPU back.
+int EmulationThread(void* data)
 {
-    // PUSH PC
-    state->memory[state->sp-1] = (state->pc & 0xFF00) >> 8;
-    state->memory[state->sp-2] = state->pc & 0xff;
-    state->sp = state->sp - 2;
+    Emulation* emulation = data;
+    Machine* machine = emulation->machine;
+    Pacer pacer;
+    InitPacer(&pacer);
+
+    while (atomic_load(&emulation->running))
+    {
+        machine->ports.input1 = atomic_load(&emulation->input1);
+        machine->ports.input2 = atomic_load(&emulation->input2);
+
+        if (atomic_load(&emulation->rewinding))
+        {
+            // Step back a frame instead of running one, and show it
+            if (PopRewind(&emulation->rewind, emulation->frame) == 0)
+            {
+                LoadSnapshot(emulation->frame, machine);
+                // The recording goes on from the earlier frame, as if the rest never happened
+                if (emulation->movie) TruncateMovie(emulation->movie, machine->scheduler.now);
+                draw_screen(&machine->state, emulation->video, 0);
+                draw_screen(&machine->state, emulation->video, 1);
+            }
+        }
+        else
+        {
+            RunMachineFrame(machine);
+            if (machine->halted)
+            {
+                // Nothing more will happen: have the main thread shut down as if the window closed
+                printf("The CPU halted\n");
+                SDL_Event quit = { .type = SDL_QUIT };
+                SDL_PushEvent(&quit);
+                break;
+            }
+            SaveSnapshot(emulation->frame, machine);
+            PushRewind(&emulation->rewind, emulation->frame);
+        }
 
-    // Set the PC to the low memory vector
-    state->pc = 8 * interrupt_num;
+        int request = atomic_exchange(&emulation->snapshot_request, SNAPSHOT_NONE);
+        if (request == SNAPSHOT_SAVE)
+        {
+            SaveSnapshot(emulation->quick_save, machine);
+            emulation->has_quick_save = 1;
+        }
+        else if (request == SNAPSHOT_LOAD && emulation->has_quick_save)
+        {
+            // A quick save may come from input the recording no longer has
+            if (emulation->movie) printf("Quick load is off while recording a movie\n");
+            else LoadSnapshot(emulation->quick_save, machine);
+        }
 
-    state->int_enable = 0;  // DI
+        if (emulation->throttle) PaceFrame(&pacer);
+
+//        // Print for debugging
+//        State8080* state = &machine->state;
+//        printf("\t");
+//        printf("%c", state->cc.z ? 'z' : '.');
+//        printf("%c", state->cc.s ? 's' : '.');
+//        printf("%c", state->cc.p ? 'p' : '.');
+//        printf("%c", state->cc.cy ? 'c' : '.');
+//        printf("%c  ", state->cc.ac ? 'a' : '.');
+//        printf("PC $%02x ", state->pc);
+//        printf("A $%02x B $%02x C $%02x D $%02x E $%02x H $%02x L $%02x SP %04x\n", state->a, state->b, state->c,
+//               state->d, state->e, state->h, state->l, state->sp);
+//        fflush(stdout);
+    }
+    return 0;
 }
 
-double HandleInterrupt(State8080* state, Uint32 lastInterrupt, uint8_t* interrupt_num, SDL_Renderer* renderer, SDL_Surface* surface)
+int main(int argc, char**argv)
 {
-    if (state->int_enable == 0) return lastInterrupt;
-    Uint32 currentTime = SDL_GetTicks64();
-    if ((currentTime - lastInterrupt) > (8))
+    Core core = CORE_BATCH;
+    int throttle = 1;
+    int headless = 0;
+    int profile = 0;
+    int check_crc = 1;
+    int rewind_bench = 0;
+    const char* rom_directory = "../Rom";
+    const char* load_path = NULL;
+    const char* save_path = NULL;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    long frames = 600;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--unthrottled") == 0) throttle = 0;
+        if (strcmp(argv[i], "--headless") == 0) headless = 1;
+        if (strcmp(argv[i], "--profile") == 0) profile = 1;
+        if (strcmp(argv[i], "--no-crc") == 0) check_crc = 0;
+        if (strcmp(argv[i], "--rewind") == 0) rewind_bench = 1;
+        if (strcmp(argv[i], "--rom-dir") == 0 && i + 1 < argc) rom_directory = argv[++i];
+        if (strcmp(argv[i], "--load-state") == 0 && i + 1 < argc) load_path = argv[++i];
+        if (strcmp(argv[i], "--save-state") == 0 && i + 1 < argc) save_path = argv[++i];
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) record_path = argv[++i];
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replay_path = argv[++i];
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frames = strtol(argv[++i], NULL, 10);
+        if (strcmp(argv[i], "--core") == 0 && i + 1 < argc && ParseCoreName(argv[++i], &core) != 0) return 1;
+    }
+
+    // The ROM is mapped in place, nothing is copied
+    RomSet rom;
+    if (LoadRomSet(&rom, rom_directory, check_crc) != 0) return 1;
+    Machine* machine = NewMachine(&rom, core);
+    State8080* state = &machine->state;
+    if (profile)
     {
-        GenerateInterrupt(state, *interrupt_num + 1);
-        draw_screen(state, renderer, *interrupt_num, surface);
+#ifdef PROFILE
+        state->profile = NewProfile8080();
+        if (state->profile == NULL) return 1;
+#else
+        printf("error: --profile needs a build configured with -DPROFILE=ON\n");
+        return 1;
+#endif
+    }
 
-        *interrupt_num ^= 1;    // toggles between 0-1
-        return currentTime;
+    // Start from a snapshot instead of reset
+    static uint8_t snapshot[SNAPSHOT_SIZE];
+    if (load_path)
+    {
+        if (ReadSnapshotFile(load_path, snapshot) != 0 || LoadSnapshot(snapshot, machine) != 0)
+            return 1;
     }
-    return lastInterrupt;
-}
 
-int RunCPUCycles(State8080* state, int last_processing, Ports* ports)
-{
-    // Stay here for a few cycles to keep up
-    int cycles_per_frame = 3000;
-    int elapsed_time = (int) SDL_GetTicks64() - last_processing;
-    int cycles = (int) (elapsed_time * cycles_per_frame);
-    unsigned char *opcode;
-    if (cycles == 0) return last_processing;
-    while (cycles > 0)
+    // A replay runs headless, from where the movie starts to where it ends
+    static Movie movie;
+    if (replay_path)
     {
-        opcode = &state->memory[state->pc];
-//        Disassemble8080Op(state->memory, state->pc);
-
-        // Game has specific function for IN/OUT, which isn't in the general emulator function
-        // IN
-        if (*opcode == 0xdb) {
-            uint8_t port = opcode[1];
-            MachineIN(port, ports, state);
-            state->pc += 2;
+        if (record_path)
+        {
+            printf("error: --record and --replay don't go together\n");
+            return 1;
         }
-        // OUT
-        else if (*opcode == 0xd3) {
-            uint8_t port = opcode[1];
-            uint8_t old_bits;
-            if (port == 3) old_bits = ports->output3;
-            else if (port == 5) old_bits = ports->output5;
-            MachineOUT(port, ports, state);
-            state->pc += 2;
-            if (port == 3 || port == 5) PlaySounds(ports, port, old_bits);
-        } else
-            Emulate8080Op(state);
-        cycles -= cycles8080[*opcode];
+        if (ReadMovieFile(replay_path, &movie) != 0 || StartReplay(&movie, machine) != 0)
+            return 1;
+        headless = 1;
     }
+    if (record_path) StartRecording(&movie, machine);
 
-    return (int) SDL_GetTicks64();
-}
+    if (headless)
+    {
+        // Benchmark: no window, no audio, no pacing
+        static Rewind rewind;
+        if (rewind_bench && InitRewind(&rewind, REWIND_BYTES, REWIND_FRAMES) != 0) return 1;
+        Uint64 rewind_ticks = 0;
+        // Counted from here, a loaded snapshot may not start at cycle 0
+        uint64_t start_cycles = machine->scheduler.now;
+        uint64_t start_instructions = state->instructions;
+        Uint64 start = SDL_GetPerformanceCounter();
+        long frame = 0;
+        for (; replay_path ? !ReplayDone(&movie, machine) : frame < frames && !machine->halted; frame++)
+        {
+            RunMachineFrame(machine);
+            if (rewind_bench)
+            {
+                Uint64 push_start = SDL_GetPerformanceCounter();
+                SaveSnapshot(snapshot, machine);
+                PushRewind(&rewind, snapshot);
+                rewind_ticks += SDL_GetPerformanceCounter() - push_start;
+            }
+        }
+        double seconds = (double) (SDL_GetPerformanceCounter() - start) / (double) SDL_GetPerformanceFrequency();
+        uint64_t cycles = machine->scheduler.now - start_cycles;
+        uint64_t instructions = state->instructions - start_instructions;
 
+        printf("%ld frames, %llu cycles, %llu instructions in %.3f s\n", frame,
+               (unsigned long long) cycles, (unsigned long long) instructions, seconds);
+        printf("%.2f emulated MHz, %.1f frames/s, %.2f M instructions/s\n",
+               cycles / seconds / 1e6, frame / seconds, instructions / seconds / 1e6);
+        if (replay_path)
+        {
+            if (StopReplay(&movie, machine) != 0) return 1;
+            printf("replay: %d input changes, ended in the recorded state\n", movie.count);
+        }
+        if (record_path)
+        {
+            if (StopRecording(&movie, machine) != 0) return 1;
+            if (WriteMovieFile(record_path, &movie) != 0) return 1;
+        }
+        FreeMovie(&movie);
+        if (rewind_bench)
+        {
+            // Step all the way back to time decoding, without touching the machine
+            static uint8_t older[SNAPSHOT_SIZE];
+            long pops = 0;
+            Uint64 pop_start = SDL_GetPerformanceCounter();
+            while (PopRewind(&rewind, older) == 0)
+                pops++;
+            Uint64 pop_ticks = SDL_GetPerformanceCounter() - pop_start;
+            double us_per_tick = 1e6 / (double) SDL_GetPerformanceFrequency();
+
+            PrintRewindStats(&rewind);
+            printf("rewind: save and encode %.2f us per frame, decode %.2f us per frame stepped back\n",
+                   rewind_ticks * us_per_tick / (frame ? frame : 1), pop_ticks * us_per_tick / (pops ? pops : 1));
+            FreeRewind(&rewind);
+        }
+        if (state->profile) PrintProfile8080(state->profile, state->map, PROFILE_TOP);
+        if (save_path)
+        {
+            SaveSnapshot(snapshot, machine);
+            if (WriteSnapshotFile(save_path, snapshot) != 0) return 1;
+        }
+        FreeMachine(machine);
+        UnloadRomSet(&rom);
+        return 0;
+    }
 
-int main(int argc, char**argv)
-{
     // Initialize SDL
     if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_AUDIO) != 0) {
         printf("SDL_Init Error: %s\n", SDL_GetError());
         return 1;
     }
+    // All sound effects are decoded up front; without an audio device the game runs silent
+    static Mixer mixer;
+    char sound_directory[512];
+    snprintf(sound_directory, sizeof(sound_directory), "%s/Sounds", rom_directory);
+    int audio_enabled = InitSound(&mixer, sound_directory) == 0;
 
     // Create a window
     SDL_Window* window = SDL_CreateWindow("8080 Emulator",
                                           SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
                                           224 * 3, 256 * 3, SDL_WINDOW_SHOWN);
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, 224, 256, 32, SDL_PIXELFORMAT_RGBA8888);
-    if (!surface) {
-        printf("SDL_CreateSurface Error: %s\n", SDL_GetError());
-        return 1;
-    }
+    // Presenting runs on this thread, apart from the CPU, so waiting on vsync costs the emulation nothing
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    Display display;
+    if (InitDisplay(&display, renderer) != 0) return 1;
 
-    // Initialize states
-    State8080* state = calloc(1, sizeof(State8080));
-    state->memory = malloc(0x10000);  // 16K
+    FrameRing ring;
+    InitFrameRing(&ring);
+    static Video video;
+    InitVideo(&video, &ring);
+    state->dirty_lines = video.dirty_lines;
+    Frontend frontend = { &mixer, &video };
+    machine->hooks.user = &frontend;
+    machine->hooks.screen = ScreenHook;
+    if (audio_enabled) machine->hooks.sound = SoundHook;
 
-    Ports* ports = calloc(1, sizeof(Ports));
-    InitPorts(ports);
+    // The key handlers work on this thread's own copy of the ports, the emulation
+    // thread picks up the input bytes once per frame
+    Ports keys;
+    InitPorts(&keys);
 
-    Uint32 last_interrupt = SDL_GetTicks64();
-    Uint32 last_processing = last_interrupt;
-    uint8_t interrupt_num = 0;
+    static Emulation emulation;
+    emulation.machine = machine;
+    emulation.video = &video;
+    emulation.movie = record_path ? &movie : NULL;
+    emulation.throttle = throttle;
+    emulation.has_quick_save = 0;
+    if (InitRewind(&emulation.rewind, REWIND_BYTES, REWIND_FRAMES) != 0) return 1;
+    atomic_init(&emulation.running, 1);
+    atomic_init(&emulation.input1, keys.input1);
+    atomic_init(&emulation.input2, keys.input2);
+    atomic_init(&emulation.snapshot_request, SNAPSHOT_NONE);
+    atomic_init(&emulation.rewinding, 0);
 
-    // Read files into state[memory]
-    ReadFileMem(state, "../Rom/invaders", 0);
-//    ReadFileMem(state, "../Rom/invaders.h", 0);
-//    ReadFileMem(state, "../Rom/invaders.g", 0x800);
-//    ReadFileMem(state, "../Rom/invaders.f", 0x1000);
-//    ReadFileMem(state, "../Rom/invaders.e", 0x1800);
+    SDL_Thread* thread = SDL_CreateThread(EmulationThread, "emulation", &emulation);
+    if (!thread) {
+        printf("SDL_CreateThread Error: %s\n", SDL_GetError());
+        return 1;
+    }
 
     SDL_Event event;
     int running = 1;
@@ -199,28 +360,50 @@ int main(int argc, char**argv)
             }
             if (event.type == SDL_KEYDOWN)
             {
-                KeyDown(event.key.keysym.sym, ports);
+                KeyDown(event.key.keysym.sym, &keys);
+                if (event.key.keysym.sym == SDLK_F5) atomic_store(&emulation.snapshot_request, SNAPSHOT_SAVE);
+                if (event.key.keysym.sym == SDLK_F9) atomic_store(&emulation.snapshot_request, SNAPSHOT_LOAD);
+                if (event.key.keysym.sym == SDLK_BACKSPACE) atomic_store(&emulation.rewinding, 1);
             }
             if (event.type == SDL_KEYUP)
             {
-                KeyUp(event.key.keysym.sym, ports);
+                KeyUp(event.key.keysym.sym, &keys);
+                if (event.key.keysym.sym == SDLK_BACKSPACE) atomic_store(&emulation.rewinding, 0);
             }
         }
+        atomic_store(&emulation.input1, keys.input1);
+        atomic_store(&emulation.input2, keys.input2);
 
-        last_interrupt = (int) HandleInterrupt(state, last_interrupt, &interrupt_num, renderer, surface);
-        last_processing = RunCPUCycles(state, (int) last_processing, ports);
-
-//        // Print for debugging
-//        printf("\t");
-//        printf("%c", state->cc.z ? 'z' : '.');
-//        printf("%c", state->cc.s ? 's' : '.');
-//        printf("%c", state->cc.p ? 'p' : '.');
-//        printf("%c", state->cc.cy ? 'c' : '.');
-//        printf("%c  ", state->cc.ac ? 'a' : '.');
-//        printf("PC $%02x ", state->pc);
-//        printf("A $%02x B $%02x C $%02x D $%02x E $%02x H $%02x L $%02x SP %04x\n", state->a, state->b, state->c,
-//               state->d, state->e, state->h, state->l, state->sp);
-//        fflush(stdout);
+        // Nothing new to show: give the time back instead of spinning
+        if (!PresentFrame(&display, &ring)) SDL_Delay(1);
     }
+    atomic_store(&emulation.running, 0);
+    SDL_WaitThread(thread, NULL);
+    if (save_path)
+    {
+        SaveSnapshot(snapshot, machine);
+        WriteSnapshotFile(save_path, snapshot);
+    }
+    if (record_path)
+    {
+        // A recording that lost input would fail its replay, so it isn't written
+        if (StopRecording(&movie, machine) == 0) WriteMovieFile(record_path, &movie);
+        FreeMovie(&movie);
+    }
+
+    PrintVideoStats(&video);
+    PrintDisplayStats(&display, &ring);
+    PrintRewindStats(&emulation.rewind);
+    FreeRewind(&emulation.rewind);
+    FreeVideo(&video);
+    FreeFrameRing(&ring);
+    FreeDisplay(&display);
+    CloseSound(&mixer);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    if (state->profile) PrintProfile8080(state->profile, state->map, PROFILE_TOP);
+    FreeMachine(machine);
+    UnloadRomSet(&rom);
     return 0;
 }
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "romset.h"
+#include "runner.h"
+#include "snapshot.h"
+
+static int RunForks(const RomSet* rom, Core core, long frames, int forks, long fork_frames, uint64_t seed);
+
+// Fork benchmark: plays one machine for frames, then branches it forks times the way a
+// tree search would, against cloning it through a snapshot. Every child then plays
+// fork_frames frames of its own random input, and keeps the RAM pages it dirtied.
+static int RunForks(const RomSet* rom, Core core, long frames, int forks, long fork_frames, uint64_t seed)
+{
+    Runner* runner = NewRunner(rom, core, 1, seed, 0);
+    if (RunInstances(runner, frames, 1, 1) < 0.0)
+    {
+        FreeRunner(runner);
+        return 1;
+    }
+    Machine* root = runner->instances[0].machine;
+    Machine** children = calloc(forks, sizeof(Machine*));
+
+    uint8_t snapshot[SNAPSHOT_SIZE];
+    double start = Seconds();
+    for (int i = 0; i < forks; i++)
+    {
+        children[i] = NewMachine(rom, core);
+        SaveSnapshot(snapshot, root);
+        LoadSnapshot(snapshot, children[i]);
+    }
+    double cloned = Seconds() - start;
+    for (int i = 0; i < forks; i++)
+        FreeMachine(children[i]);
+
+    start = Seconds();
+    for (int i = 0; i < forks; i++)
+        children[i] = ForkMachine(root);
+    double forked = Seconds() - start;
+
+    uint64_t rng = seed | 1;
+    start = Seconds();
+    for (int i = 0; i < forks; i++)
+    {
+        uint8_t held = 0;
+        for (long frame = 0; frame < fork_frames; frame++)
+        {
+            if (frame % 8 == 0)
+            {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+                held = (uint8_t) (rng & 0x70);      // 1P SHOOT, LEFT, RIGHT
+            }
+            children[i]->ports.input1 = 0b00001000 | held;
+            RunMachineFrame(children[i]);
+        }
+    }
+    double played = Seconds() - start;
+
+    // A child owns a page once its reference count is back to one
+    long pages = 0;
+    for (int i = 0; i < forks; i++)
+        for (int page = 0; page < RAM_PAGES; page++)
+            if (atomic_load(&children[i]->ram[page]->refs) == 1) pages++;
+    double per_fork = sizeof(Machine) + (double) pages / forks * sizeof(RamPage);
+    double per_clone = sizeof(Machine) + RAM_PAGES * sizeof(RamPage);
+
+    printf("%d forks of a machine %ld frames in, %ld frames each\n", forks, frames, fork_frames);
+    printf("snapshot clone %12.0f /s %10.0f bytes each\n", forks / cloned, per_clone);
+    printf("fork           %12.0f /s %10.0f bytes each after %ld frames, %.1f of %d pages private\n",
+           forks / forked, per_fork, fork_frames, (double) pages / forks, RAM_PAGES);
+    if (fork_frames)
+        printf("children played %.1f frames/s\n", (double) forks * fork_frames / played);
+
+    for (int i = 0; i < forks; i++)
+        FreeMachine(children[i]);
+    free(children);
+    FreeRunner(runner);
+    return 0;
+}
+
+// Headless throughput runner: many machines at once on a work-stealing pool, no SDL.
+// Runs the same instances and frames at 1, 2, 4 ... 64 threads (or only --threads T) and
+// prints aggregate frames per second and the scaling efficiency against one thread.
+// --lanes K runs the machines K at a time in lockstep on the lane core instead.
+// --forks N benchmarks copy-on-write forks of one machine, --fork-frames K played by each.
+int main(int argc, char**argv)
+{
+    Core core = CORE_BATCH;
+    int check_crc = 1;
+    int instances = 64;
+    int slice = 1;
+    int threads = 0;            // 0: sweep
+    int lanes = 0;              // 0: scalar
+    int forks = 0;
+    long frames = 600;
+    long fork_frames = 60;
+    uint64_t seed = 1;
+    const char* rom_directory = "../Rom";
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-crc") == 0) check_crc = 0;
+        if (strcmp(argv[i], "--rom-dir") == 0 && i + 1 < argc) rom_directory = argv[++i];
+        if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) instances = atoi(argv[++i]);
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frames = strtol(argv[++i], NULL, 10);
+        if (strcmp(argv[i], "--slice") == 0 && i + 1 < argc) slice = atoi(argv[++i]);
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc) lanes = atoi(argv[++i]);
+        if (strcmp(argv[i], "--forks") == 0 && i + 1 < argc) forks = atoi(argv[++i]);
+        if (strcmp(argv[i], "--fork-frames") == 0 && i + 1 < argc) fork_frames = strtol(argv[++i], NULL, 10);
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        if (strcmp(argv[i], "--core") == 0 && i + 1 < argc && ParseCoreName(argv[++i], &core) != 0) return 1;
+    }
+    if (instances < 1 || frames < 1 || slice < 1 || threads < 0 || threads > RUNNER_MAX_THREADS)
+    {
+        printf("error: Need at least one instance, frame and frame per slice, and 1-%d threads\n",
+               RUNNER_MAX_THREADS);
+        return 1;
+    }
+    if (lanes < 0 || lanes > LANES_8080)
+    {
+        printf("error: --lanes takes 1-%d\n", LANES_8080);
+        return 1;
+    }
+
+    if (forks < 0 || fork_frames < 0)
+    {
+        printf("error: --forks and --fork-frames cannot be negative\n");
+        return 1;
+    }
+
+    RomSet rom;
+    if (LoadRomSet(&rom, rom_directory, check_crc) != 0) return 1;
+    if (forks)
+    {
+        int result = RunForks(&rom, core, frames, forks, fork_frames, seed);
+        UnloadRomSet(&rom);
+        return result;
+    }
+
+    printf("%d instances, %ld frames each, %d frames per slice, ", instances, frames, slice);
+    if (lanes) printf("%d lanes per group\n", lanes);
+    else printf("one machine per task\n");
+    printf("threads    seconds     frames/s  efficiency   steals  checksum\n");
+    double single = 0.0;        // frames/s on one thread
+    uint32_t expected = 0;     // checksum of the first run
+    int mismatches = 0;
+    for (int count = threads ? threads : 1; count <= (threads ? threads : RUNNER_MAX_THREADS); count *= 2)
+    {
+        // Fresh machines each time, so every thread count runs exactly the same work
+        Runner* runner = NewRunner(&rom, core, instances, seed, lanes);
+        double seconds = RunInstances(runner, frames, slice, count);
+        if (seconds < 0.0)
+        {
+            FreeRunner(runner);
+            UnloadRomSet(&rom);
+            return 1;
+        }
+        double rate = (double) instances * frames / seconds;
+        long steals = 0;
+        for (int i = 0; i < count; i++)
+            steals += runner->workers[i].steals;
+        uint32_t checksum = RunnerChecksum(runner);
+        uint64_t steps = 0, lane_steps = 0, vector_steps = 0;
+        for (int i = 0; i < runner->group_count; i++)
+        {
+            if (!runner->groups[i].lanes) continue;
+            steps += runner->groups[i].lanes->steps;
+            lane_steps += runner->groups[i].lanes->lane_steps;
+            vector_steps += runner->groups[i].lanes->vector_steps;
+        }
+        FreeRunner(runner);
+
+        if (count == 1) single = rate;
+        if (count == (threads ? threads : 1)) expected = checksum;
+        else if (checksum != expected) mismatches++;
+        if (single > 0.0)
+            printf("%7d %10.3f %12.1f %10.1f%% %8ld  %08x\n", count, seconds, rate,
+                   100.0 * rate / (single * count), steals, checksum);
+        else
+            printf("%7d %10.3f %12.1f %11s %8ld  %08x\n", count, seconds, rate, "-", steals, checksum);
+        if (steps)
+            printf("        %.1f lanes per instruction issued, %.1f%% issued as SIMD passes\n",
+                   (double) lane_steps / steps, 100.0 * vector_steps / steps);
+    }
+
+    UnloadRomSet(&rom);
+    if (mismatches)
+    {
+        printf("error: Machine state differs between thread counts\n");
+        return 1;
+    }
+    return 0;
+}
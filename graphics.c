@@ -1,41 +1,171 @@
 # include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "graphics.h"
+#include "8080memory.h"
 
-void draw_screen(State8080* state, SDL_Renderer* renderer, int interrupt_num, SDL_Surface* surface) {
-    uint8_t *video_memory = &state->memory[0x2400];  // Starting address for video memory
-    int start_y = (interrupt_num == 0) ? 0 : 112;   // Top half or bottom half
-    int end_y = (interrupt_num == 0) ? 112 : 224;
+static uint32_t* NewScreenBuffer(void)
+{
+    uint32_t* pixels = calloc(256 * 224, sizeof(uint32_t));
+    if (!pixels) {
+        printf("error: Couldn't allocate a screen buffer\n");
+        exit(1);
+    }
+    return pixels;
+}
+
+void InitFrameRing(FrameRing* ring)
+{
+    for (int i = 0; i < FRAME_BUFFERS; i++) {
+        ring->frames[i].pixels = NewScreenBuffer();
+        ring->frames[i].first = 0;
+        ring->frames[i].last = 0;
+    }
+    ring->back = 0;
+    ring->front = 1;
+    atomic_init(&ring->latest, 2);
+    atomic_init(&ring->published, 0);
+}
 
+void FreeFrameRing(FrameRing* ring)
+{
+    for (int i = 0; i < FRAME_BUFFERS; i++) {
+        free(ring->frames[i].pixels);
+        ring->frames[i].pixels = NULL;
+    }
+}
 
+void InitVideo(Video* video, FrameRing* ring)
+{
+    video->ring = ring;
+    video->pixels = NewScreenBuffer();
+    memset(video->dirty_lines, 1, sizeof(video->dirty_lines));     // first frame draws everything
+    video->pending_first = 224;
+    video->pending_last = 0;
+    video->lines_drawn = 0;
+    video->frames = 0;
+    video->draw_ticks = 0;
+    video->frame_ticks = 0;
+    video->max_frame_ticks = 0;
+}
 
+void FreeVideo(Video* video)
+{
+    free(video->pixels);
+    video->pixels = NULL;
+}
 
-    uint32_t color;
-    for (int y = start_y; y < end_y; y++) {
-        for (int x = 0; x < 256; x++) {
-            int byte_offset = y * 32 + x / 8;
-            int bit_offset = x % 8;
+// Emulation thread: hands the finished screen to the renderer. If the previous frame
+// was never taken, its changed columns are added to this one's so the renderer's
+// texture still ends up complete.
+static void PublishFrame(Video* video)
+{
+    FrameRing* ring = video->ring;
+    Frame* frame = &ring->frames[ring->back];
+    int first = video->pending_first, last = video->pending_last;
 
-            color = (video_memory[byte_offset] & (1 << bit_offset)) ? 0xFFFFFFFF : 0x00000000;
-            ((uint32_t*)surface->pixels)[(255 - x) * 224 + y] = color;
-        }
+    int latest = atomic_load(&ring->latest);
+    if (latest & FRAME_FRESH) {
+        const Frame* skipped = &ring->frames[latest & ~FRAME_FRESH];
+        if (skipped->first < first) first = skipped->first;
+        if (skipped->last > last) last = skipped->last;
     }
 
+    memcpy(frame->pixels, video->pixels, 256 * 224 * sizeof(uint32_t));
+    frame->first = first;
+    frame->last = last;
+    ring->back = atomic_exchange(&ring->latest, ring->back | FRAME_FRESH) & ~FRAME_FRESH;
+    atomic_fetch_add(&ring->published, 1);
+
+    video->pending_first = 224;
+    video->pending_last = 0;
+}
+
+void draw_screen(State8080* state, Video* video, int interrupt_num) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    uint8_t *dirty = &video->dirty_lines[0x2400 >> 5];
+    int start_y = (interrupt_num == 0) ? 0 : 112;   // Top half or bottom half
+    int end_y = (interrupt_num == 0) ? 112 : 224;
 
+    // Decode only the groups of 8 lines (one tile row) that were written since they
+    // were last drawn
+    for (int y = start_y; y < end_y; y += 8) {
+        uint64_t written;
+        memcpy(&written, &dirty[y], sizeof(written));
+        if (written == 0) continue;
+        memset(&dirty[y], 0, 8);
+
+        // 8 lines of 32 bytes are exactly one page of video memory, starting at 0x2400
+        const uint8_t* lines = state->map->read[(0x2400 >> 8) + (y >> 3)];
+        DecodeScreen(lines, 0, 8, &video->pixels[y], 224 * sizeof(uint32_t));
+        if (y < video->pending_first) video->pending_first = y;
+        if (y + 8 > video->pending_last) video->pending_last = y + 8;
+        video->lines_drawn += 8;
+    }
+
+    if (interrupt_num == 1) PublishFrame(video);
+
+    Uint64 ticks = SDL_GetPerformanceCounter() - start;
+    video->draw_ticks += ticks;
+    video->frame_ticks += ticks;
     if (interrupt_num == 1) {
-        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
-        if (!texture) {
-            printf("SDL_CreateTexture Error: %s\n", SDL_GetError());
-            return;
-        }
+        if (video->frame_ticks > video->max_frame_ticks) video->max_frame_ticks = video->frame_ticks;
+        video->frame_ticks = 0;
+        video->frames++;
+    }
+}
 
-        SDL_Rect destRect = { 0, 0, 224 * 3, 256 * 3};
-        SDL_RenderCopy(renderer, texture, NULL, &destRect);
+void PrintVideoStats(const Video* video)
+{
+    if (video->frames == 0) return;
+    double ms_per_tick = 1000.0 / (double) SDL_GetPerformanceFrequency();
+    printf("video: %llu frames, draw time %.3f ms average, %.3f ms worst, %.1f%% of the screen redrawn per frame\n",
+           (unsigned long long) video->frames,
+           video->draw_ticks * ms_per_tick / video->frames, video->max_frame_ticks * ms_per_tick,
+           100.0 * video->lines_drawn / (video->frames * 224.0));
+}
 
-        // Clean up the texture
-        SDL_DestroyTexture(texture);
+int InitDisplay(Display* display, SDL_Renderer* renderer)
+{
+    display->renderer = renderer;
+    display->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, 224, 256);
+    if (!display->texture) {
+        printf("SDL_CreateTexture Error: %s\n", SDL_GetError());
+        return 1;
+    }
+    SDL_SetTextureBlendMode(display->texture, SDL_BLENDMODE_NONE);
+    display->frames = 0;
+    return 0;
+}
+
+void FreeDisplay(Display* display)
+{
+    SDL_DestroyTexture(display->texture);
+    display->texture = NULL;
+}
 
+// Render thread (the one that owns the renderer): shows the newest published frame.
+// Returns 0 without touching the screen when nothing new has been published.
+int PresentFrame(Display* display, FrameRing* ring)
+{
+    if (!(atomic_load(&ring->latest) & FRAME_FRESH)) return 0;
+    ring->front = atomic_exchange(&ring->latest, ring->front) & ~FRAME_FRESH;
 
-        SDL_RenderPresent(renderer);
+    const Frame* frame = &ring->frames[ring->front];
+    if (frame->first < frame->last) {
+        SDL_Rect columns = { frame->first, 0, frame->last - frame->first, 256 };
+        SDL_UpdateTexture(display->texture, &columns, &frame->pixels[frame->first], 224 * sizeof(uint32_t));
     }
-}
\ No newline at end of file
+
+    SDL_Rect destRect = { 0, 0, 224 * 3, 256 * 3};
+    SDL_RenderCopy(display->renderer, display->texture, NULL, &destRect);
+    SDL_RenderPresent(display->renderer);
+    display->frames++;
+    return 1;
+}
+
+void PrintDisplayStats(const Display* display, const FrameRing* ring)
+{
+    unsigned long long published = atomic_load(&ring->published);
+    printf("display: %llu of %llu frames presented\n", (unsigned long long) display->frames, published);
+}
@@ -1,9 +1,66 @@
 #ifndef INC_8080EMULATOR_GRAPHICS_H
 #define INC_8080EMULATOR_GRAPHICS_H
 
+#include <stdatomic.h>
 #include "8080emulator.h"
+#include "screen.h"
 #include <SDL2/SDL.h>
 
-void draw_screen(State8080* state, SDL_Renderer* renderer, int interrupt_num, SDL_Surface* surface);
+#define FRAME_BUFFERS   3
+#define FRAME_FRESH     0x4     // set in FrameRing.latest until the renderer takes that frame
+
+// A finished screen, 224x256 RGBA8888 already rotated, and the texture columns
+// (video lines) that differ from the last frame the renderer took
+typedef struct Frame {
+    uint32_t*   pixels;
+    int         first;
+    int         last;
+} Frame;
+
+// Triple buffer between the emulation thread and the renderer. Each side owns one
+// frame, the third is handed over through an atomic exchange of latest, so neither
+// side ever waits for the other and the renderer always gets the newest frame.
+typedef struct FrameRing {
+    Frame       frames[FRAME_BUFFERS];
+    atomic_int  latest;     // index of the newest published frame | FRAME_FRESH
+    int         back;       // emulation thread's frame
+    int         front;      // renderer's frame
+    atomic_ullong   published;
+} FrameRing;
+
+// Emulation side of the screen: a decoded copy of video memory, which video lines
+// changed, and the time spent decoding so changes to this path can be measured
+typedef struct Video {
+    FrameRing*      ring;
+    uint32_t*       pixels;         // the screen as of the last draw_screen, 224 pixels per row
+    uint8_t         dirty_lines[0x10000 >> 5];  // state->dirty_lines points here
+    int             pending_first;  // columns changed since the last published frame
+    int             pending_last;
+    Uint64          lines_drawn;    // video lines decoded, 224 is a full screen
+    Uint64          frames;
+    Uint64          draw_ticks;     // performance counter ticks spent in draw_screen
+    Uint64          frame_ticks;    // ticks for the frame in progress
+    Uint64          max_frame_ticks;
+} Video;
+
+// Render side: one streaming texture that lives as long as the renderer
+typedef struct Display {
+    SDL_Renderer*   renderer;
+    SDL_Texture*    texture;
+    Uint64          frames;         // frames presented
+} Display;
+
+void InitFrameRing(FrameRing* ring);
+void FreeFrameRing(FrameRing* ring);
+
+void InitVideo(Video* video, FrameRing* ring);
+void FreeVideo(Video* video);
+void draw_screen(State8080* state, Video* video, int interrupt_num);
+void PrintVideoStats(const Video* video);
+
+int InitDisplay(Display* display, SDL_Renderer* renderer);
+void FreeDisplay(Display* display);
+int PresentFrame(Display* display, FrameRing* ring);
+void PrintDisplayStats(const Display* display, const FrameRing* ring);
 
 #endif //INC_8080EMULATOR_GRAPHICS_H
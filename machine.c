@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "machine.h"
+#include "8080block.h"
+#include "profiler.h"
+#include "movie.h"
+
+static void VideoWrite(State8080* state, uint16_t address, uint8_t value);
+static void SharedWrite(State8080* state, uint16_t address, uint8_t value);
+static void MapRamPage(Machine* machine, int page);
+static void InitMemoryMap(Machine* machine, const RomSet* rom);
+static void ReleaseRamPage(RamPage* page);
+static void MachineIN(Machine* machine, uint8_t port, uint64_t when);
+static void MachineOUT(Machine* machine, uint8_t port, uint64_t when);
+static void GenerateInterrupt(State8080* state, int interrupt_num);
+static int RunCore(Machine* machine, int cycle_budget, Exit8080* reason);
+static int RunCPUCycles(Machine* machine, int cycle_budget);
+static int StartLaneSlice(Lanes8080* lanes, int lane, Machine* machine);
+static int FinishLaneExit(Lanes8080* lanes, int lane, Machine* machine);
+static int LaneExit(void* user, Lanes8080* lanes, int lane);
+
+// Video RAM stores also mark the 32 byte line they hit, so the screen only redraws what changed
+static void VideoWrite(State8080* state, uint16_t address, uint8_t value)
+{
+    state->map->read[address >> 8][address & 0xff] = value;
+    if (state->dirty_lines) state->dirty_lines[(address & 0x3fff) >> 5] = 1;
+}
+
+// First store to a page shared with forks: take a copy, then store the usual way. Cores
+// may run on a copy of the State8080, but its map is always the machine's own.
+static void SharedWrite(State8080* state, uint16_t address, uint8_t value)
+{
+    Machine* machine = (Machine*) ((char*) state->map - offsetof(Machine, map));
+    OwnRamPage(machine, RAM_FIRST_PAGE + ((address >> 8) & (RAM_PAGES - 1)));
+    WriteMem8080(state, address, value);
+}
+
+// Points page and its mirrors at the page's bytes: work RAM is stored to directly and
+// video RAM through VideoWrite while the machine holds the only reference, anything
+// shared goes through SharedWrite
+static void MapRamPage(Machine* machine, int page)
+{
+    RamPage* ram = machine->ram[page - RAM_FIRST_PAGE];
+    int own = atomic_load_explicit(&ram->refs, memory_order_acquire) == 1;
+    for (int mirror = 0; mirror < PAGE_COUNT; mirror += 0x40)
+    {
+        if (!own) MapPages8080(&machine->map, mirror + page, 1, ram->data, 0, SharedWrite);
+        else if (page < 0x24) MapPages8080(&machine->map, mirror + page, 1, ram->data, 1, NULL);
+        else MapPages8080(&machine->map, mirror + page, 1, ram->data, 0, VideoWrite);
+    }
+}
+
+// The board decodes only A0-A13: ROM at 0x0000-0x1FFF (writes are ignored), work RAM at
+// 0x2000-0x23FF, video RAM at 0x2400-0x3FFF, and the same 16K again every 0x4000.
+// ROM pages point straight into the mapped ROM files.
+static void InitMemoryMap(Machine* machine, const RomSet* rom)
+{
+    for (int mirror = 0; mirror < PAGE_COUNT; mirror += 0x40)
+    {
+        for (int page = 0; page < ROM_PAGES; page++)
+            MapPages8080(&machine->map, mirror + page, 1, (uint8_t*) rom->page[page], 0, NULL);
+    }
+    for (int page = 0; page < RAM_PAGES; page++)
+    {
+        machine->ram[page] = calloc(1, sizeof(RamPage));
+        atomic_init(&machine->ram[page]->refs, 1);
+        MapRamPage(machine, RAM_FIRST_PAGE + page);
+    }
+}
+
+static void ReleaseRamPage(RamPage* page)
+{
+    if (atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) == 1)
+        free(page);
+}
+
+uint8_t* OwnRamPage(Machine* machine, int page)
+{
+    RamPage** ram = &machine->ram[page - RAM_FIRST_PAGE];
+    // A sharer that already copied may have left this machine the last reference
+    if (atomic_load_explicit(&(*ram)->refs, memory_order_acquire) != 1)
+    {
+        RamPage* copy = malloc(sizeof(RamPage));
+        atomic_init(&copy->refs, 1);
+        memcpy(copy->data, (*ram)->data, PAGE_SIZE);
+        ReleaseRamPage(*ram);
+        *ram = copy;
+    }
+    MapRamPage(machine, page);
+    return (*ram)->data;
+}
+
+void InitPorts(Ports* ports)
+{
+    ports->input0 = 0b00001110; // Bits 1, 2, 3 are always 1; other inputs are default 0.
+    ports->input1 = 0b00001000; // Bit 3 is always 1; all others default to 0.
+    ports->input2 = 0b00000000;
+
+    ports->shift_register = 0x0000;
+    ports->shift_amount = 0;
+    ports->output2 = 0;
+    ports->output3 = 0;
+    ports->output5 = 0;
+    ports->output6 = 0;
+}
+
+int ParseCoreName(const char* name, Core* core)
+{
+    static const char* const names[] = { "batch", "switch", "threaded", "blocks" };  // in Core order
+    for (int i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *core = (Core) i;
+            return 0;
+        }
+    }
+    printf("error: Unknown core %s\n", name);
+    return 1;
+}
+
+Machine* NewMachine(const RomSet* rom, Core core)
+{
+    Machine* machine = calloc(1, sizeof(Machine));  // zeroed so runs are reproducible
+    machine->core = core;
+    machine->rom_crc = rom->crc32;
+    InitMemoryMap(machine, rom);
+    machine->state.map = &machine->map;     // RAM is paged, so there is no flat state.memory
+    if (core == CORE_BLOCKS) machine->state.blocks = NewBlockCache8080();
+    InitPorts(&machine->ports);
+
+    InitScheduler(&machine->scheduler);
+    ScheduleEvent(&machine->scheduler, MID_SCREEN_CYCLE, EVENT_MID_SCREEN);
+    ScheduleEvent(&machine->scheduler, VBLANK_CYCLE, EVENT_VBLANK);
+    return machine;
+}
+
+void FreeMachine(Machine* machine)
+{
+    if (machine->state.blocks) FreeBlockCache8080(machine->state.blocks);
+    if (machine->state.profile) FreeProfile8080(machine->state.profile);
+    for (int page = 0; page < RAM_PAGES; page++)
+        ReleaseRamPage(machine->ram[page]);
+    free(machine);
+}
+
+Machine* ForkMachine(Machine* parent)
+{
+    Machine* child = malloc(sizeof(Machine));
+    *child = *parent;
+    child->state.map = &child->map;
+    child->state.blocks = parent->state.blocks ? NewBlockCache8080() : NULL;
+    child->state.profile = NULL;
+    child->state.dirty_lines = NULL;
+    child->hooks = (MachineHooks) { 0 };
+    child->movie = NULL;
+
+    // Both sides go copy-on-write, the parent included: its next store to any page copies
+    for (int page = 0; page < RAM_PAGES; page++)
+    {
+        atomic_fetch_add_explicit(&child->ram[page]->refs, 1, memory_order_relaxed);
+        MapRamPage(parent, RAM_FIRST_PAGE + page);
+        MapRamPage(child, RAM_FIRST_PAGE + page);
+    }
+    return child;
+}
+
+// when is the emulated cycle of the IN, a movie feeds or logs the input ports on it
+static void MachineIN(Machine* machine, uint8_t port, uint64_t when)
+{
+    State8080* state = &machine->state;
+    Ports* ports = &machine->ports;
+    if (machine->movie && (port == 1 || port == 2)) MovieInput(machine->movie, machine, when);
+    switch (port) {
+        case 0:
+            state->a = ports->input0;
+            break;
+        case 1:
+            state->a = ports->input1;
+            break;
+        case 2:
+            state->a = ports->input2;
+            break;
+        case 3:
+            // read shift register with shifted amount
+            state->a = ((ports->shift_register >> (8 - ports->shift_amount)) & 0xff);
+            break;
+        default:
+            break;
+    }
+}
+
+// when is the emulated cycle of the OUT, sound events are stamped with it
+static void MachineOUT(Machine* machine, uint8_t port, uint64_t when)
+{
+    State8080* state = &machine->state;
+    Ports* ports = &machine->ports;
+    MachineHooks* hooks = &machine->hooks;
+    uint8_t old_bits;
+    switch (port) {
+        case 2:
+            ports->shift_amount = state->a & 0x7;
+            break;
+        case 3:
+            old_bits = ports->output3;
+            ports->output3 = state->a;
+            if (hooks->sound) hooks->sound(hooks->user, port, old_bits, ports->output3, when);
+            break;
+        case 4:
+            // shift register moves left half to right side, and place new value on left side
+            ports->shift_register = (state->a << 8) | (ports->shift_register >> 8);
+            break;
+        case 5:
+            old_bits = ports->output5;
+            ports->output5 = state->a;
+            if (hooks->sound) hooks->sound(hooks->user, port, old_bits, ports->output5, when);
+            break;
+        case 6:
+            ports->output6 = state->a;
+            break;
+        default:
+            break;
+    }
+}
+
+static void GenerateInterrupt(State8080* state, int interrupt_num)
+{
+    // PUSH PC
+    WriteMem8080(state, state->sp-1, (state->pc & 0xFF00) >> 8);
+    WriteMem8080(state, state->sp-2, state->pc & 0xff);
+    state->sp = state->sp - 2;
+
+    // Set the PC to the low memory vector
+    state->pc = 8 * interrupt_num;
+
+    state->int_enable = 0;  // DI
+}
+
+// Runs up to cycle_budget cycles on the machine's core, stopping in front of IN/OUT/HLT
+// and after EI
+static int RunCore(Machine* machine, int cycle_budget, Exit8080* reason)
+{
+    State8080* state = &machine->state;
+    if (machine->core == CORE_BATCH) return Run8080(state, cycle_budget, reason);
+
+    int cycles = 0;
+    while (cycles < cycle_budget)
+    {
+        uint8_t op = ReadMem8080(state, state->pc);
+        if (op == 0xdb) { *reason = EXIT_IN; return cycles; }
+        if (op == 0xd3) { *reason = EXIT_OUT; return cycles; }
+        if (op == 0x76) { *reason = EXIT_HLT; return cycles; }
+
+        uint8_t was_enabled = state->int_enable;
+        if (machine->core == CORE_BLOCKS) cycles += Emulate8080Block(state, cycle_budget - cycles);
+        else if (machine->core == CORE_THREADED) cycles += Emulate8080OpThreaded(state);
+        else cycles += Emulate8080Op(state);
+        if (state->int_enable && !was_enabled) { *reason = EXIT_EI; return cycles; }
+    }
+    *reason = EXIT_BUDGET;
+    return cycles;
+}
+
+// Runs about cycle_budget cycles from the scheduler's current cycle, handling port I/O
+// along the way; returns the cycles used
+static int RunCPUCycles(Machine* machine, int cycle_budget)
+{
+    State8080* state = &machine->state;
+    uint64_t now = machine->scheduler.now;
+    int cycles = 0;
+    while (cycles < cycle_budget)
+    {
+        Exit8080 reason;
+        cycles += RunCore(machine, cycle_budget - cycles, &reason);
+
+        // Game has specific function for IN/OUT, which isn't in the general emulator function
+        if (reason == EXIT_IN) {
+            uint8_t port = ReadMem8080(state, state->pc + 1);
+            MachineIN(machine, port, now + cycles);
+            if (state->profile) ProfileOp8080(state->profile, state->pc, 0xdb, cycles8080[0xdb]);
+            state->pc += 2;
+            state->instructions++;
+            cycles += cycles8080[0xdb];
+        }
+        else if (reason == EXIT_OUT) {
+            uint8_t port = ReadMem8080(state, state->pc + 1);
+            MachineOUT(machine, port, now + cycles);
+            if (state->profile) ProfileOp8080(state->profile, state->pc, 0xd3, cycles8080[0xd3]);
+            state->pc += 2;
+            state->instructions++;
+            cycles += cycles8080[0xd3];
+        }
+        else if (reason == EXIT_HLT) {
+            machine->halted = 1;
+            break;
+        }
+        // EI: return so a pending interrupt goes in right away
+        else if (reason == EXIT_EI)
+            break;
+    }
+    return cycles;
+}
+
+void RunMachineFrame(Machine* machine)
+{
+    Scheduler* scheduler = &machine->scheduler;
+    MachineHooks* hooks = &machine->hooks;
+    int frame_done = 0;
+    while (!frame_done && !machine->halted)
+    {
+        Event event;
+        while (PopDueEvent(scheduler, &event))
+        {
+            if (event.id == EVENT_MID_SCREEN) {
+                if (hooks->screen) hooks->screen(hooks->user, machine, 0);
+                machine->pending_interrupt = 1;
+            } else {
+                if (hooks->screen) hooks->screen(hooks->user, machine, 1);
+                machine->pending_interrupt = 2;
+                frame_done = 1;
+            }
+            ScheduleEvent(scheduler, event.when + CYCLES_PER_FRAME, event.id);
+        }
+        if (frame_done) break;
+
+        if (machine->pending_interrupt && machine->state.int_enable)
+        {
+            GenerateInterrupt(&machine->state, machine->pending_interrupt);
+            machine->pending_interrupt = 0;
+        }
+        scheduler->now += RunCPUCycles(machine, CyclesToNextEvent(scheduler));
+    }
+}
+
+// The top of RunMachineFrame's loop for one lane, with its registers in the machine:
+// events, then the interrupt, then a budget up to the next event. Returns 0 when the
+// frame is over instead.
+static int StartLaneSlice(Lanes8080* lanes, int lane, Machine* machine)
+{
+    Scheduler* scheduler = &machine->scheduler;
+    MachineHooks* hooks = &machine->hooks;
+    int frame_done = 0;
+    Event event;
+    while (PopDueEvent(scheduler, &event))
+    {
+        if (event.id == EVENT_MID_SCREEN) {
+            if (hooks->screen) hooks->screen(hooks->user, machine, 0);
+            machine->pending_interrupt = 1;
+        } else {
+            if (hooks->screen) hooks->screen(hooks->user, machine, 1);
+            machine->pending_interrupt = 2;
+            frame_done = 1;
+        }
+        ScheduleEvent(scheduler, event.when + CYCLES_PER_FRAME, event.id);
+    }
+    if (frame_done) return 0;
+
+    if (machine->pending_interrupt && machine->state.int_enable)
+    {
+        GenerateInterrupt(&machine->state, machine->pending_interrupt);
+        machine->pending_interrupt = 0;
+    }
+    LoadLane8080(lanes, lane, &machine->state);
+    lanes->cycles[lane] = 0;
+    lanes->budget[lane] = CyclesToNextEvent(scheduler);
+    return 1;
+}
+
+// RunCPUCycles' handling of why the lane stopped; returns 1 when the lane goes on with
+// the same budget, 0 when its slice is over and its registers are back in the machine
+static int FinishLaneExit(Lanes8080* lanes, int lane, Machine* machine)
+{
+    State8080* state = &machine->state;
+    Exit8080 reason = lanes->exit[lane];
+    if (reason == EXIT_IN || reason == EXIT_OUT)
+    {
+        uint16_t pc = lanes->pc[lane];
+        uint8_t port = ReadMem8080(state, pc + 1);
+        state->a = lanes->reg[7][lane];
+        if (reason == EXIT_IN) MachineIN(machine, port, machine->scheduler.now + lanes->cycles[lane]);
+        else MachineOUT(machine, port, machine->scheduler.now + lanes->cycles[lane]);
+        lanes->reg[7][lane] = state->a;
+        lanes->pc[lane] = pc + 2;
+        lanes->instructions[lane]++;
+        lanes->cycles[lane] += cycles8080[reason == EXIT_IN ? 0xdb : 0xd3];
+        if (lanes->cycles[lane] < lanes->budget[lane]) return 1;
+    }
+    else if (reason == EXIT_HLT)
+        machine->halted = 1;
+
+    machine->scheduler.now += lanes->cycles[lane];
+    StoreLane8080(lanes, lane);
+    return 0;
+}
+
+// on_exit for RunLanes8080: finishes what stopped the lane and, once its slice is over,
+// starts the next one, so the lane keeps going until its frame is done
+static int LaneExit(void* user, Lanes8080* lanes, int lane)
+{
+    Machine* machine = ((Machine**) user)[lane];
+    if (FinishLaneExit(lanes, lane, machine)) return 1;
+    if (machine->halted) return 0;
+    return StartLaneSlice(lanes, lane, machine);
+}
+
+void RunMachineFramesInLanes(Lanes8080* lanes, Machine** machines, int count)
+{
+    lanes->count = count;
+    lanes->running = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (!machines[i]->halted && StartLaneSlice(lanes, i, machines[i])) lanes->running |= 1u << i;
+    }
+    RunLanes8080(lanes, LaneExit, machines);
+}
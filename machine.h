@@ -0,0 +1,93 @@
+#ifndef INC_8080EMULATOR_MACHINE_H
+#define INC_8080EMULATOR_MACHINE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "8080emulator.h"
+#include "8080memory.h"
+#include "8080lanes.h"
+#include "ports.h"
+#include "scheduler.h"
+#include "romset.h"
+
+// Video timing of a 2 MHz CPU at 60 frames per second, in emulated cycles
+#define CYCLES_PER_FRAME    33333
+#define MID_SCREEN_CYCLE    16666   // beam reaches the middle of the screen: RST 1
+#define VBLANK_CYCLE        33333   // beam reaches the bottom: RST 2
+
+enum { EVENT_MID_SCREEN, EVENT_VBLANK };
+
+// RAM and video RAM, 0x2000-0x3FFF, in 256 byte pages
+#define RAM_FIRST_PAGE      0x20
+#define RAM_PAGES           0x20
+
+// One page of RAM, shared copy-on-write between a machine and its forks. A machine
+// writes in place while it holds the only reference; otherwise its first store copies
+// the page.
+typedef struct RamPage {
+    atomic_int  refs;
+    uint8_t     data[PAGE_SIZE];
+} RamPage;
+
+// Which core runs the CPU
+typedef enum Core {
+    CORE_BATCH,     // Run8080, many instructions per call
+    CORE_SWITCH,    // Emulate8080Op, one instruction per call
+    CORE_THREADED,  // Emulate8080OpThreaded, one instruction per call
+    CORE_BLOCKS,    // Emulate8080Block, one basic block per call
+} Core;
+
+// The core named name, as --core takes it: batch, switch, threaded or blocks. Returns
+// nonzero, leaving core alone, for any other name.
+int ParseCoreName(const char* name, Core* core);
+
+struct Machine;
+
+// How a machine reaches the outside world, all optional. Called on the thread running the machine.
+typedef struct MachineHooks {
+    void*   user;
+    // OUT 3 or OUT 5 changed from old_bits to bits at emulated cycle when
+    void    (*sound)(void* user, int port, uint8_t old_bits, uint8_t bits, uint64_t when);
+    // The beam passed the middle (half 0) or the bottom (half 1) of the screen
+    void    (*screen)(void* user, struct Machine* machine, int half);
+} MachineHooks;
+
+// One Space Invaders board. It owns all of its state, shares only the read-only ROM and
+// copy-on-write RAM pages with its forks, and never touches globals, so any number of
+// machines can run side by side.
+typedef struct Machine {
+    State8080       state;
+    Ports           ports;
+    Scheduler       scheduler;
+    uint8_t         pending_interrupt;  // raised while interrupts were disabled
+    Core            core;
+    int             halted;             // the CPU ran HLT, frames no longer advance
+    uint32_t        rom_crc;
+    MachineHooks    hooks;
+    struct Movie*   movie;              // optional, records or replays the input ports (movie.h)
+    MemoryMap8080   map;
+    RamPage*        ram[RAM_PAGES];     // the ROM stays in the RomSet
+} Machine;
+
+// A machine at power-on, running rom on core
+Machine* NewMachine(const RomSet* rom, Core core);
+void FreeMachine(Machine* machine);
+// A copy of parent that shares its RAM pages until either one writes them. The fork has no
+// hooks, movie, profile or video line tracking; a CORE_BLOCKS fork gets an empty block cache.
+// Forks are independent machines and can run on other threads.
+Machine* ForkMachine(Machine* parent);
+// Makes RAM page (RAM_FIRST_PAGE + 0 .. RAM_PAGES - 1) the machine's own, copying it if
+// forks still share it, and returns its bytes for writing
+uint8_t* OwnRamPage(Machine* machine, int page);
+// Power-on values of the ports
+void InitPorts(Ports* ports);
+// Runs one video frame: the CPU goes from event to event on the scheduler and the screen
+// hook runs when the beam passes each half. Interrupts raised while they are disabled
+// stay pending until the game enables them again.
+void RunMachineFrame(Machine* machine);
+// Runs one frame on each of count machines (at most LANES_8080) with their CPUs on lanes,
+// in lockstep wherever they execute the same ROM code, whatever their cores. Every machine
+// ends up exactly where RunMachineFrame would have left it.
+void RunMachineFramesInLanes(Lanes8080* lanes, Machine** machines, int count);
+
+#endif //INC_8080EMULATOR_MACHINE_H
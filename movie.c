@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+
+static const char magic[8] = { '8', '0', '8', '0', 'M', 'O', 'V', 'I' };
+
+// Fixed part of the file, besides the optional snapshot
+#define MOVIE_HEADER_SIZE   (8 + 4 + 4 + 1 + 2 + 8 + 8 + 4 + 4)
+#define MOVIE_EVENT_MAX     (10 + 5 + 1)    // longest encoding of one event
+
+static uint8_t* Put32(uint8_t* p, uint32_t value);
+static uint8_t* Put64(uint8_t* p, uint64_t value);
+static uint8_t* PutVarint(uint8_t* p, uint64_t value);
+static uint32_t Get32(const uint8_t** p);
+static uint64_t Get64(const uint8_t** p);
+static int GetVarint(const uint8_t** p, const uint8_t* end, uint64_t* value);
+static uint64_t EventCycle(const MovieEvent* event);
+static int AddEvent(Movie* movie, uint64_t when, uint8_t port, uint8_t value);
+static uint32_t SnapshotCrc(Machine* machine);
+
+static uint8_t* Put32(uint8_t* p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (value >> (8 * i)) & 0xff;
+    return p + 4;
+}
+
+static uint8_t* Put64(uint8_t* p, uint64_t value)
+{
+    p = Put32(p, value & 0xffffffff);
+    return Put32(p, value >> 32);
+}
+
+// 7 bits at a time, low first, top bit set on every byte but the last
+static uint8_t* PutVarint(uint8_t* p, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t) value;
+    return p;
+}
+
+static uint32_t Get32(const uint8_t** p)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= (uint32_t) (*p)[i] << (8 * i);
+    *p += 4;
+    return value;
+}
+
+static uint64_t Get64(const uint8_t** p)
+{
+    uint64_t low = Get32(p);
+    return low | ((uint64_t) Get32(p) << 32);
+}
+
+// Returns nonzero if the varint runs past end or over 64 bits
+static int GetVarint(const uint8_t** p, const uint8_t* end, uint64_t* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7)
+    {
+        uint8_t byte = *(*p)++;
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return 1;
+}
+
+static uint64_t EventCycle(const MovieEvent* event)
+{
+    return event->frame * CYCLES_PER_FRAME + event->cycle;
+}
+
+// Returns nonzero, with the events so far kept, if there is no memory for another one
+static int AddEvent(Movie* movie, uint64_t when, uint8_t port, uint8_t value)
+{
+    if (movie->count == movie->capacity)
+    {
+        int capacity = movie->capacity ? movie->capacity * 2 : 256;
+        MovieEvent* events = realloc(movie->events, capacity * sizeof(MovieEvent));
+        if (events == NULL)
+        {
+            printf("error: Out of memory for the movie, the recording stops here\n");
+            return 1;
+        }
+        movie->events = events;
+        movie->capacity = capacity;
+    }
+    MovieEvent* event = &movie->events[movie->count++];
+    event->frame = when / CYCLES_PER_FRAME;
+    event->cycle = (uint32_t) (when % CYCLES_PER_FRAME);
+    event->port = port;
+    event->value = value;
+    return 0;
+}
+
+static uint32_t SnapshotCrc(Machine* machine)
+{
+    uint8_t snapshot[SNAPSHOT_SIZE];
+    SaveSnapshot(snapshot, machine);
+    return Crc32(0, snapshot, SNAPSHOT_SIZE);
+}
+
+void StartRecording(Movie* movie, Machine* machine)
+{
+    movie->mode = MOVIE_RECORDING;
+    movie->rom_crc = machine->rom_crc;
+    // Nothing has run at cycle 0, so the machine is as NewMachine made it
+    movie->from_snapshot = machine->scheduler.now != 0;
+    if (movie->from_snapshot) SaveSnapshot(movie->snapshot, machine);
+    movie->input1 = movie->seen1 = machine->ports.input1;
+    movie->input2 = movie->seen2 = machine->ports.input2;
+    movie->start = movie->end = machine->scheduler.now;
+    movie->end_crc = 0;
+    movie->events = NULL;
+    movie->count = 0;
+    movie->capacity = 0;
+    movie->next = 0;
+    movie->lost = 0;
+    machine->movie = movie;
+}
+
+int StopRecording(Movie* movie, Machine* machine)
+{
+    movie->end = machine->scheduler.now;
+    movie->end_crc = SnapshotCrc(machine);
+    movie->mode = MOVIE_IDLE;
+    machine->movie = NULL;
+    return movie->lost;
+}
+
+void TruncateMovie(Movie* movie, uint64_t cycle)
+{
+    while (movie->count > 0 && EventCycle(&movie->events[movie->count - 1]) >= cycle)
+        movie->count--;
+    // What the CPU last read is now whatever the events left say
+    movie->seen1 = movie->input1;
+    movie->seen2 = movie->input2;
+    for (int i = 0; i < movie->count; i++)
+    {
+        if (movie->events[i].port == 1) movie->seen1 = movie->events[i].value;
+        else movie->seen2 = movie->events[i].value;
+    }
+}
+
+int StartReplay(Movie* movie, Machine* machine)
+{
+    if (movie->rom_crc != machine->rom_crc)
+    {
+        printf("error: Movie was recorded with ROM %08x, running %08x\n",
+               (unsigned) movie->rom_crc, (unsigned) machine->rom_crc);
+        return 1;
+    }
+    if (movie->from_snapshot && LoadSnapshot(movie->snapshot, machine) != 0) return 1;
+    if (!movie->from_snapshot && machine->scheduler.now != 0)
+    {
+        printf("error: Movie starts at power-on, the machine has already run\n");
+        return 1;
+    }
+    machine->ports.input1 = movie->input1;
+    machine->ports.input2 = movie->input2;
+    movie->next = 0;
+    movie->mode = MOVIE_REPLAYING;
+    machine->movie = movie;
+    return 0;
+}
+
+int ReplayDone(const Movie* movie, const Machine* machine)
+{
+    return machine->scheduler.now >= movie->end || machine->halted;
+}
+
+int StopReplay(Movie* movie, Machine* machine)
+{
+    movie->mode = MOVIE_IDLE;
+    machine->movie = NULL;
+    uint32_t crc = SnapshotCrc(machine);
+    if (crc != movie->end_crc)
+    {
+        printf("error: Replay ended in state %08x at cycle %llu, the recording in %08x at cycle %llu\n",
+               (unsigned) crc, (unsigned long long) machine->scheduler.now,
+               (unsigned) movie->end_crc, (unsigned long long) movie->end);
+        return 1;
+    }
+    return 0;
+}
+
+void MovieInput(Movie* movie, Machine* machine, uint64_t when)
+{
+    Ports* ports = &machine->ports;
+    if (movie->mode == MOVIE_RECORDING && !movie->lost)
+    {
+        if (ports->input1 != movie->seen1)
+        {
+            movie->lost |= AddEvent(movie, when, 1, ports->input1);
+            movie->seen1 = ports->input1;
+        }
+        if (ports->input2 != movie->seen2)
+        {
+            movie->lost |= AddEvent(movie, when, 2, ports->input2);
+            movie->seen2 = ports->input2;
+        }
+    }
+    else if (movie->mode == MOVIE_REPLAYING)
+    {
+        while (movie->next < movie->count && EventCycle(&movie->events[movie->next]) <= when)
+        {
+            const MovieEvent* event = &movie->events[movie->next++];
+            if (event->port == 1) ports->input1 = event->value;
+            else ports->input2 = event->value;
+        }
+    }
+}
+
+void FreeMovie(Movie* movie)
+{
+    free(movie->events);
+    movie->events = NULL;
+    movie->count = 0;
+    movie->capacity = 0;
+}
+
+int WriteMovieFile(const char* path, const Movie* movie)
+{
+    size_t size = MOVIE_HEADER_SIZE + (movie->from_snapshot ? SNAPSHOT_SIZE : 0) +
+                  (size_t) movie->count * MOVIE_EVENT_MAX;
+    uint8_t* data = malloc(size);
+    if (data == NULL)
+    {
+        printf("error: Out of memory for the movie\n");
+        return 1;
+    }
+
+    uint8_t* p = data;
+    memcpy(p, magic, sizeof(magic));
+    p += sizeof(magic);
+    p = Put32(p, MOVIE_VERSION);
+    p = Put32(p, movie->rom_crc);
+    *p++ = movie->from_snapshot ? MOVIE_FROM_SNAPSHOT : 0;
+    if (movie->from_snapshot)
+    {
+        memcpy(p, movie->snapshot, SNAPSHOT_SIZE);
+        p += SNAPSHOT_SIZE;
+    }
+    *p++ = movie->input1;
+    *p++ = movie->input2;
+    p = Put64(p, movie->start);
+    p = Put64(p, movie->end);
+    p = Put32(p, movie->end_crc);
+    p = Put32(p, (uint32_t) movie->count);
+
+    uint64_t frame = movie->start / CYCLES_PER_FRAME;
+    for (int i = 0; i < movie->count; i++)
+    {
+        const MovieEvent* event = &movie->events[i];
+        p = PutVarint(p, (event->frame - frame) << 1 | (event->port == 2));
+        p = PutVarint(p, event->cycle);
+        *p++ = event->value;
+        frame = event->frame;
+    }
+
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        printf("error: Couldn't create %s\n", path);
+        free(data);
+        return 1;
+    }
+    size_t length = p - data;
+    size_t written = fwrite(data, 1, length, f);
+    free(data);
+    if (fclose(f) != 0 || written != length)
+    {
+        printf("error: Couldn't write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int ReadMovieFile(const char* path, Movie* movie)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("error: Couldn't open %s\n", path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = length > 0 ? malloc(length) : NULL;
+    size_t read = data ? fread(data, 1, length, f) : 0;
+    fclose(f);
+    if (data == NULL || read != (size_t) length)
+    {
+        printf("error: Couldn't read %s\n", path);
+        free(data);
+        return 1;
+    }
+
+    const uint8_t* p = data;
+    const uint8_t* end = data + length;
+    int ok = length >= MOVIE_HEADER_SIZE && memcmp(p, magic, sizeof(magic)) == 0;
+    if (!ok)
+    {
+        printf("error: %s is not a movie\n", path);
+        free(data);
+        return 1;
+    }
+    p += sizeof(magic);
+    uint32_t version = Get32(&p);
+    if (version != MOVIE_VERSION)
+    {
+        printf("error: Movie version %u, this build reads version %d\n", (unsigned) version, MOVIE_VERSION);
+        free(data);
+        return 1;
+    }
+    movie->rom_crc = Get32(&p);
+    movie->from_snapshot = (*p++ & MOVIE_FROM_SNAPSHOT) != 0;
+    ok = length >= MOVIE_HEADER_SIZE + (movie->from_snapshot ? SNAPSHOT_SIZE : 0);
+    uint32_t count = 0;
+    if (ok)
+    {
+        if (movie->from_snapshot)
+        {
+            memcpy(movie->snapshot, p, SNAPSHOT_SIZE);
+            p += SNAPSHOT_SIZE;
+        }
+        movie->input1 = *p++;
+        movie->input2 = *p++;
+        movie->start = Get64(&p);
+        movie->end = Get64(&p);
+        movie->end_crc = Get32(&p);
+        count = Get32(&p);
+        // Every event takes at least 3 bytes
+        ok = count <= (uint32_t) (end - p) / 3;
+    }
+
+    movie->events = ok && count ? malloc(count * sizeof(MovieEvent)) : NULL;
+    if (ok && count && movie->events == NULL)
+    {
+        printf("error: Out of memory for the movie\n");
+        free(data);
+        FreeMovie(movie);
+        return 1;
+    }
+    movie->count = 0;
+    movie->capacity = (int) count;
+    uint64_t frame = movie->start / CYCLES_PER_FRAME;
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        MovieEvent* event = &movie->events[i];
+        uint64_t stamp, cycle;
+        ok = GetVarint(&p, end, &stamp) == 0 && GetVarint(&p, end, &cycle) == 0 && p < end &&
+             cycle < CYCLES_PER_FRAME;
+        if (!ok) break;
+        frame += stamp >> 1;
+        event->frame = frame;
+        event->cycle = (uint32_t) cycle;
+        event->port = (stamp & 1) ? 2 : 1;
+        event->value = *p++;
+        movie->count++;
+    }
+    free(data);
+    if (!ok || p != end)
+    {
+        printf("error: %s is corrupt\n", path);
+        FreeMovie(movie);
+        return 1;
+    }
+    movie->mode = MOVIE_IDLE;
+    movie->next = 0;
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef INC_8080EMULATOR_MOVIE_H
+#define INC_8080EMULATOR_MOVIE_H
+
+#include <stdint.h>
+#include "machine.h"
+#include "snapshot.h"
+
+// Movie file format, all fields little-endian:
+//   "8080MOVI", version, CRC32 of the ROM, flags, the start snapshot if MOVIE_FROM_SNAPSHOT,
+//   input1 and input2 at the start, start and end cycle, CRC32 of the snapshot at the end,
+//   event count, then the events. Each event is a varint of (frames since the event before
+//   << 1 | port 2), a varint of its cycle within the frame and the new port value, so most
+//   take 4 bytes. Bump the version whenever the layout changes.
+#define MOVIE_VERSION           1
+#define MOVIE_FROM_SNAPSHOT     0x01    // starts from a snapshot instead of power-on
+
+// Input port 1 or 2 changed to value. The CPU saw it first on an IN at emulated cycle
+// frame * CYCLES_PER_FRAME + cycle since reset.
+typedef struct MovieEvent {
+    uint64_t    frame;
+    uint32_t    cycle;
+    uint8_t     port;
+    uint8_t     value;
+} MovieEvent;
+
+typedef enum MovieMode { MOVIE_IDLE, MOVIE_RECORDING, MOVIE_REPLAYING } MovieMode;
+
+// Input of one session, keyed on emulated cycles so it plays back the same on any host.
+// Recording logs the input ports each time an IN reads a value different from the one
+// before; replay puts every value back just before the IN that first read it.
+typedef struct Movie {
+    MovieMode   mode;
+    uint32_t    rom_crc;
+    int         from_snapshot;
+    uint8_t     snapshot[SNAPSHOT_SIZE];    // where it starts, if from_snapshot
+    uint8_t     input1;                     // input ports at the start
+    uint8_t     input2;
+    uint64_t    start;                      // emulated cycles since reset
+    uint64_t    end;
+    uint32_t    end_crc;                    // CRC32 of the snapshot at the end
+    MovieEvent* events;
+    int         count;
+    int         capacity;
+    int         next;                       // replay: first event not yet applied
+    uint8_t     seen1;                      // recording: what the last IN of each port read
+    uint8_t     seen2;
+    int         lost;                       // recording: ran out of memory, input is missing
+} Movie;
+
+// Starts recording machine's input from where it is now; the machine must be between frames
+void StartRecording(Movie* movie, Machine* machine);
+// Ends the recording here and stamps the final state; returns nonzero if the recording
+// ran out of memory on the way and misses input, so it won't replay
+int StopRecording(Movie* movie, Machine* machine);
+// Drops the input from cycle on, for a recording machine that went back in time (rewind)
+void TruncateMovie(Movie* movie, uint64_t cycle);
+// Puts machine, fresh from NewMachine, where the movie starts and feeds it the movie's
+// input; returns nonzero and leaves the machine alone if the movie is for another ROM.
+// Every core replays every movie, they all run the same cycles.
+int StartReplay(Movie* movie, Machine* machine);
+// The replaying machine has run all of the movie
+int ReplayDone(const Movie* movie, const Machine* machine);
+// Ends the replay; returns nonzero if machine didn't end up in the recorded state
+int StopReplay(Movie* movie, Machine* machine);
+// Called on every IN from port 1 or 2 at emulated cycle when, before the port is read
+void MovieInput(Movie* movie, Machine* machine, uint64_t when);
+void FreeMovie(Movie* movie);
+int WriteMovieFile(const char* path, const Movie* movie);
+// Fills a zeroed movie from path
+int ReadMovieFile(const char* path, Movie* movie);
+
+#endif //INC_8080EMULATOR_MOVIE_H
@@ -1,7 +1,7 @@
 #ifndef INC_8080EMULATOR_PORTS_H
 #define INC_8080EMULATOR_PORTS_H
 
-#include "ports.h"
+#include <stdint.h>
 
 
 typedef struct Ports {
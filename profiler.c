@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "profiler.h"
+#include "Disassembler/disassembler.h"
+
+static const Profile8080* sort_profile;     // qsort has no context argument
+
+static int CompareAddressCycles(const void* a, const void* b);
+static int CompareOpcodeCycles(const void* a, const void* b);
+
+Profile8080* NewProfile8080(void)
+{
+    Profile8080* profile = calloc(1, sizeof(Profile8080));
+    if (profile == NULL) printf("error: Couldn't allocate the profiler\n");
+    return profile;
+}
+
+void FreeProfile8080(Profile8080* profile)
+{
+    free(profile);
+}
+
+void ProfileOp8080(Profile8080* profile, uint16_t pc, uint8_t op, int cycles)
+{
+    profile->pc_count[pc]++;
+    profile->pc_cycles[pc] += cycles;
+    profile->op_count[op]++;
+    profile->op_cycles[op] += cycles;
+}
+
+static int CompareAddressCycles(const void* a, const void* b)
+{
+    uint64_t x = sort_profile->pc_cycles[*(const uint16_t*) a];
+    uint64_t y = sort_profile->pc_cycles[*(const uint16_t*) b];
+    return (x < y) - (x > y);   // most cycles first
+}
+
+static int CompareOpcodeCycles(const void* a, const void* b)
+{
+    uint64_t x = sort_profile->op_cycles[*(const uint8_t*) a];
+    uint64_t y = sort_profile->op_cycles[*(const uint8_t*) b];
+    return (x < y) - (x > y);
+}
+
+// Prints the top addresses by cycles with their disassembly, then every opcode that ran.
+// Each opcode row disassembles the hottest address it ran at.
+void PrintProfile8080(const Profile8080* profile, const MemoryMap8080* map, int top)
+{
+    // Flat copy of what the CPU sees, with room for the disassembler to read operands past the end
+    static uint8_t memory[0x10000 + 2];
+    static uint16_t addresses[0x10000];
+    static uint16_t hottest[256];
+    uint8_t opcodes[256];
+    int address_count = 0;
+    int opcode_count = 0;
+    uint64_t total_cycles = 0;
+    uint64_t total_count = 0;
+
+    for (int address = 0; address < 0x10000; address++)
+        memory[address] = map->read[address >> 8][address & 0xff];
+    for (int op = 0; op < 256; op++)
+    {
+        total_cycles += profile->op_cycles[op];
+        total_count += profile->op_count[op];
+        hottest[op] = 0;
+        if (profile->op_count[op]) opcodes[opcode_count++] = op;
+    }
+    for (int pc = 0; pc < 0x10000; pc++)
+    {
+        if (profile->pc_count[pc] == 0) continue;
+        addresses[address_count++] = pc;
+        uint8_t op = memory[pc];
+        if (profile->pc_cycles[pc] > profile->pc_cycles[hottest[op]] || memory[hottest[op]] != op)
+            hottest[op] = pc;
+    }
+    if (total_cycles == 0)
+    {
+        printf("profile: nothing recorded\n");
+        return;
+    }
+
+    sort_profile = profile;
+    qsort(addresses, address_count, sizeof(addresses[0]), CompareAddressCycles);
+    qsort(opcodes, opcode_count, sizeof(opcodes[0]), CompareOpcodeCycles);
+
+    printf("profile: %llu instructions, %llu cycles, %d addresses\n",
+           (unsigned long long) total_count, (unsigned long long) total_cycles, address_count);
+
+    if (top > address_count) top = address_count;
+    printf("\nhottest addresses        count        cycles      %%   cum%%  instruction\n");
+    uint64_t running = 0;
+    for (int i = 0; i < top; i++)
+    {
+        uint16_t pc = addresses[i];
+        running += profile->pc_cycles[pc];
+        printf("%4d %14llu %13llu %6.2f %6.2f  ", i + 1,
+               (unsigned long long) profile->pc_count[pc], (unsigned long long) profile->pc_cycles[pc],
+               100.0 * profile->pc_cycles[pc] / total_cycles, 100.0 * running / total_cycles);
+        Disassemble8080Op(memory, pc);
+        printf("\n");
+    }
+
+    printf("\nopcodes                  count        cycles      %%  hottest at\n");
+    for (int i = 0; i < opcode_count; i++)
+    {
+        uint8_t op = opcodes[i];
+        printf("0x%02x %14llu %13llu %6.2f  ", op,
+               (unsigned long long) profile->op_count[op], (unsigned long long) profile->op_cycles[op],
+               100.0 * profile->op_cycles[op] / total_cycles);
+        if (memory[hottest[op]] == op) Disassemble8080Op(memory, hottest[op]);
+        printf("\n");
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef INC_8080EMULATOR_PROFILER_H
+#define INC_8080EMULATOR_PROFILER_H
+
+#include <stdint.h>
+#include "8080memory.h"
+
+// Executions and emulated cycles per address and per opcode. The cores only
+// fill this in when built with PROFILE and state->profile is set.
+typedef struct Profile8080 {
+    uint64_t    pc_count[0x10000];
+    uint64_t    pc_cycles[0x10000];
+    uint64_t    op_count[256];
+    uint64_t    op_cycles[256];
+} Profile8080;
+
+// NULL if there is no memory for the counters
+Profile8080* NewProfile8080(void);
+void FreeProfile8080(Profile8080* profile);
+void ProfileOp8080(Profile8080* profile, uint16_t pc, uint8_t op, int cycles);
+void PrintProfile8080(const Profile8080* profile, const MemoryMap8080* map, int top);
+
+#endif //INC_8080EMULATOR_PROFILER_H
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+
+static int SameRun(const uint8_t* a, const uint8_t* b, int i);
+static uint32_t Encode(uint8_t* out, const uint8_t* snapshot, const uint8_t* previous);
+static void Apply(uint8_t* snapshot, const uint8_t* encoded, uint32_t size);
+static int FindRoom(const Rewind* rewind, uint32_t size, size_t* offset);
+static void DropOldest(Rewind* rewind);
+static void Rebuild(Rewind* rewind);
+
+int InitRewind(Rewind* rewind, size_t capacity, int max_frames)
+{
+    if (capacity < REWIND_MAX_ENCODED || max_frames < 2)
+    {
+        printf("error: Rewind buffer too small\n");
+        return 1;
+    }
+    rewind->arena = malloc(capacity);
+    rewind->frames = malloc(max_frames * sizeof(RewindFrame));
+    if (rewind->arena == NULL || rewind->frames == NULL)
+    {
+        printf("error: Couldn't allocate %zu bytes of rewind history\n", capacity);
+        FreeRewind(rewind);
+        return 1;
+    }
+    rewind->capacity = capacity;
+    rewind->head = 0;
+    rewind->max_frames = max_frames;
+    rewind->first = 0;
+    rewind->count = 0;
+    rewind->since_keyframe = 0;
+    rewind->pushed = 0;
+    rewind->pushed_bytes = 0;
+    rewind->keyframes = 0;
+    rewind->keyframe_bytes = 0;
+    return 0;
+}
+
+void FreeRewind(Rewind* rewind)
+{
+    free(rewind->arena);
+    free(rewind->frames);
+    rewind->arena = NULL;
+    rewind->frames = NULL;
+}
+
+// Length of the run of equal bytes at i, compared a word at a time
+static int SameRun(const uint8_t* a, const uint8_t* b, int i)
+{
+    int start = i;
+    while (i + 8 <= SNAPSHOT_SIZE)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y) break;
+        i += 8;
+    }
+    while (i < SNAPSHOT_SIZE && a[i] == b[i])
+        i++;
+    return i - start;
+}
+
+// Encodes snapshot XOR previous (or snapshot alone when previous is NULL). Each run is a
+// control byte c followed by data:
+//   0x00-0x7F  c + 1 literal bytes of the XOR follow
+//   0x80-0xFF  ((c & 0x7F) << 8 | next byte) + 1 bytes are unchanged
+// Unchanged runs shorter than 3 bytes are cheaper as literals.
+static uint32_t Encode(uint8_t* out, const uint8_t* snapshot, const uint8_t* previous)
+{
+    static const uint8_t zeros[SNAPSHOT_SIZE];
+    if (previous == NULL) previous = zeros;
+
+    uint8_t* p = out;
+    int i = 0;
+    while (i < SNAPSHOT_SIZE)
+    {
+        int same = SameRun(snapshot, previous, i);
+        if (same >= 3 || i + same == SNAPSHOT_SIZE)
+        {
+            i += same;
+            while (same > 0)
+            {
+                int run = same > 0x8000 ? 0x8000 : same;
+                *p++ = 0x80 | ((run - 1) >> 8);
+                *p++ = (run - 1) & 0xff;
+                same -= run;
+            }
+            continue;
+        }
+
+        // Literal up to the next unchanged run worth encoding
+        int start = i;
+        uint8_t* control = p++;
+        while (i < SNAPSHOT_SIZE && i - start < 0x80)
+        {
+            if (i + 3 <= SNAPSHOT_SIZE && snapshot[i] == previous[i] &&
+                snapshot[i + 1] == previous[i + 1] && snapshot[i + 2] == previous[i + 2])
+                break;
+            *p++ = snapshot[i] ^ previous[i];
+            i++;
+        }
+        *control = (uint8_t) (i - start - 1);
+    }
+    return (uint32_t) (p - out);
+}
+
+// XORs an encoded frame into snapshot
+static void Apply(uint8_t* snapshot, const uint8_t* encoded, uint32_t size)
+{
+    const uint8_t* p = encoded;
+    const uint8_t* end = encoded + size;
+    int i = 0;
+    while (p < end)
+    {
+        uint8_t control = *p++;
+        if (control & 0x80)
+        {
+            i += (((control & 0x7f) << 8) | *p++) + 1;
+            continue;
+        }
+        for (int n = 0; n <= control; n++)
+            snapshot[i++] ^= *p++;
+    }
+}
+
+// Frames sit in the arena in push order, from the oldest one's offset up to head,
+// wrapping to the start when the end is too short
+static int FindRoom(const Rewind* rewind, uint32_t size, size_t* offset)
+{
+    if (rewind->count == 0)
+    {
+        *offset = 0;
+        return 1;
+    }
+    size_t tail = rewind->frames[rewind->first].offset;
+    if (rewind->head > tail)
+    {
+        if (rewind->capacity - rewind->head >= size) *offset = rewind->head;
+        else if (tail >= size) *offset = 0;
+        else return 0;
+        return 1;
+    }
+    if (tail - rewind->head < size) return 0;
+    *offset = rewind->head;
+    return 1;
+}
+
+// Drops the oldest keyframe with the deltas that depend on it
+static void DropOldest(Rewind* rewind)
+{
+    do {
+        rewind->first = (rewind->first + 1) % rewind->max_frames;
+        rewind->count--;
+    } while (rewind->count > 0 && !rewind->frames[rewind->first].keyframe);
+}
+
+// Decodes the newest frame from the keyframe before it
+static void Rebuild(Rewind* rewind)
+{
+    int back = rewind->count - 1;
+    while (!rewind->frames[(rewind->first + back) % rewind->max_frames].keyframe)
+        back--;
+
+    memset(rewind->last, 0, SNAPSHOT_SIZE);
+    for (int i = back; i < rewind->count; i++)
+    {
+        const RewindFrame* frame = &rewind->frames[(rewind->first + i) % rewind->max_frames];
+        Apply(rewind->last, rewind->arena + frame->offset, frame->size);
+    }
+    rewind->since_keyframe = rewind->count - 1 - back;
+}
+
+void PushRewind(Rewind* rewind, const uint8_t* snapshot)
+{
+    int keyframe = rewind->count == 0 || rewind->since_keyframe >= REWIND_KEYFRAME_INTERVAL - 1;
+    uint32_t size = Encode(rewind->scratch, snapshot, keyframe ? NULL : rewind->last);
+
+    size_t offset;
+    while (rewind->count == rewind->max_frames || !FindRoom(rewind, size, &offset))
+    {
+        DropOldest(rewind);
+        // Everything went, so there is nothing left to be a delta against
+        if (rewind->count == 0 && !keyframe)
+        {
+            keyframe = 1;
+            size = Encode(rewind->scratch, snapshot, NULL);
+        }
+    }
+
+    memcpy(rewind->arena + offset, rewind->scratch, size);
+    RewindFrame* frame = &rewind->frames[(rewind->first + rewind->count) % rewind->max_frames];
+    frame->offset = offset;
+    frame->size = size;
+    frame->keyframe = (uint8_t) keyframe;
+    rewind->count++;
+    rewind->head = offset + size;
+    rewind->since_keyframe = keyframe ? 0 : rewind->since_keyframe + 1;
+    memcpy(rewind->last, snapshot, SNAPSHOT_SIZE);
+
+    rewind->pushed++;
+    rewind->pushed_bytes += size;
+    if (keyframe)
+    {
+        rewind->keyframes++;
+        rewind->keyframe_bytes += size;
+    }
+}
+
+int PopRewind(Rewind* rewind, uint8_t* snapshot)
+{
+    if (rewind->count < 2) return 1;
+
+    const RewindFrame* frame = &rewind->frames[(rewind->first + rewind->count - 1) % rewind->max_frames];
+    rewind->count--;
+    rewind->head = frame->offset;
+    // XOR works both ways: a delta takes the newest frame back to the one before it
+    if (frame->keyframe)
+        Rebuild(rewind);
+    else
+    {
+        Apply(rewind->last, rewind->arena + frame->offset, frame->size);
+        rewind->since_keyframe--;
+    }
+    memcpy(snapshot, rewind->last, SNAPSHOT_SIZE);
+    return 0;
+}
+
+void PrintRewindStats(const Rewind* rewind)
+{
+    if (rewind->pushed == 0) return;
+
+    size_t used = 0;
+    for (int i = 0; i < rewind->count; i++)
+        used += rewind->frames[(rewind->first + i) % rewind->max_frames].size;
+    uint64_t deltas = rewind->pushed - rewind->keyframes;
+    printf("rewind: %d frames held (%.1f s at 60 fps) in %zu of %zu KB\n", rewind->count,
+           rewind->count / 60.0, used >> 10, rewind->capacity >> 10);
+    printf("rewind: %.1f bytes per frame, deltas %.1f bytes, keyframes %.1f bytes (snapshot %d bytes)\n",
+           (double) rewind->pushed_bytes / rewind->pushed,
+           deltas ? (double) (rewind->pushed_bytes - rewind->keyframe_bytes) / deltas : 0.0,
+           rewind->keyframes ? (double) rewind->keyframe_bytes / rewind->keyframes : 0.0, SNAPSHOT_SIZE);
+}
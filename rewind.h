@@ -0,0 +1,51 @@
+#ifndef INC_8080EMULATOR_REWIND_H
+#define INC_8080EMULATOR_REWIND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "snapshot.h"
+
+#define REWIND_KEYFRAME_INTERVAL    120     // frames between full snapshots
+// Longest encoding of a snapshot: one control byte per 128 literal bytes
+#define REWIND_MAX_ENCODED          (SNAPSHOT_SIZE + SNAPSHOT_SIZE / 128 + 1)
+
+// Where one frame sits in the arena
+typedef struct RewindFrame {
+    size_t      offset;
+    uint32_t    size;
+    uint8_t     keyframe;   // encoded against zeros instead of the frame before
+} RewindFrame;
+
+// History of snapshots, newest last, in a fixed byte budget. Each frame is stored as the
+// run-length encoded XOR of its snapshot with the one before; every
+// REWIND_KEYFRAME_INTERVAL frames a keyframe is stored against zeros instead. The oldest
+// keyframe and the deltas after it are dropped together when the budget runs out.
+typedef struct Rewind {
+    uint8_t*        arena;          // encoded frames, used as a circular queue
+    size_t          capacity;
+    size_t          head;           // where the next frame goes
+    RewindFrame*    frames;         // ring of frame records
+    int             max_frames;
+    int             first;
+    int             count;
+    int             since_keyframe;
+    uint8_t         last[SNAPSHOT_SIZE];            // newest frame, decoded
+    uint8_t         scratch[REWIND_MAX_ENCODED];
+
+    uint64_t        pushed;         // stats since init
+    uint64_t        pushed_bytes;
+    uint64_t        keyframes;
+    uint64_t        keyframe_bytes;
+} Rewind;
+
+// Returns nonzero, with nothing allocated, if the budget is too small or can't be allocated
+int InitRewind(Rewind* rewind, size_t capacity, int max_frames);
+void FreeRewind(Rewind* rewind);
+// Appends a snapshot as the newest frame
+void PushRewind(Rewind* rewind, const uint8_t* snapshot);
+// Drops the newest frame and writes the one before it into snapshot; returns nonzero
+// when there is nothing older to go back to
+int PopRewind(Rewind* rewind, uint8_t* snapshot);
+void PrintRewindStats(const Rewind* rewind);
+
+#endif //INC_8080EMULATOR_REWIND_H
@@ -0,0 +1,46 @@
+#ifndef INC_8080EMULATOR_ROMSET_H
+#define INC_8080EMULATOR_ROMSET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ROM_SIZE        0x2000  // 0x0000-0x1FFF
+#define ROM_PAGES       (ROM_SIZE >> 8)
+#define ROM_MAX_FILES   4
+
+// One file of a ROM set as listed in the manifest
+typedef struct RomFile {
+    const char* name;
+    uint16_t    address;    // where it goes in the address space
+    uint16_t    size;
+    uint32_t    crc32;
+} RomFile;
+
+// A file mapped read-only into this process. The OS shares the pages between
+// every process that maps the same file.
+typedef struct MappedFile {
+    const uint8_t*  data;
+    size_t          size;
+#ifdef _WIN32
+    void*           file;
+    void*           mapping;
+#endif
+} MappedFile;
+
+// The ROM as the CPU sees it: a pointer to each 256 byte page, straight into the mapped files
+typedef struct RomSet {
+    const char*     name;
+    int             file_count;
+    MappedFile      files[ROM_MAX_FILES];
+    const uint8_t*  page[ROM_PAGES];
+    uint32_t        crc32;      // of the whole image, identifies the ROM in snapshots
+} RomSet;
+
+// Continues crc over data; start from 0
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size);
+// Tries each known set in directory; prints an error and returns nonzero, with nothing
+// left mapped, if none is complete and valid
+int LoadRomSet(RomSet* rom, const char* directory, int check_crc);
+void UnloadRomSet(RomSet* rom);
+
+#endif //INC_8080EMULATOR_ROMSET_H
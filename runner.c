@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "runner.h"
+#include "snapshot.h"
+
+// Deque results besides a group index
+#define TASK_EMPTY  -1
+#define TASK_RETRY  -2      // lost a race for the top entry, another may be there
+
+static uint64_t NextRandom(uint64_t* state);
+static void InitDeque(Deque* deque, int capacity);
+static void PushTask(Deque* deque, int task);
+static int TakeTask(Deque* deque);
+static int StealTask(Deque* deque);
+static void ScriptInput(Instance* instance);
+static void RunSlice(Runner* runner, int task, Worker* worker);
+static int FindTask(Runner* runner, Worker* worker);
+static void* WorkerThread(void* arg);
+
+// xorshift64*
+static uint64_t NextRandom(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+double Seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Every group sits in at most one deque, so capacity for all of them never overflows
+static void InitDeque(Deque* deque, int capacity)
+{
+    long size = 1;
+    while (size < capacity) size <<= 1;
+    deque->tasks = calloc(size, sizeof(atomic_int));
+    deque->mask = size - 1;
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+}
+
+// Owner only
+static void PushTask(Deque* deque, int task)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    atomic_store_explicit(&deque->tasks[bottom & deque->mask], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+// Owner only: newest task first, racing thieves only for the last one
+static int TakeTask(Deque* deque)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    int task = TASK_EMPTY;
+    if (top <= bottom)
+    {
+        task = atomic_load_explicit(&deque->tasks[bottom & deque->mask], memory_order_relaxed);
+        if (top == bottom)
+        {
+            if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                         memory_order_seq_cst, memory_order_relaxed))
+                task = TASK_EMPTY;
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    }
+    else
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return task;
+}
+
+// Any thread: oldest task first
+static int StealTask(Deque* deque)
+{
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) return TASK_EMPTY;
+
+    int task = atomic_load_explicit(&deque->tasks[top & deque->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return TASK_RETRY;
+    return task;
+}
+
+// Player 1 inserts a coin, presses start, then holds random mixes of left, right and
+// shoot for 8-39 frames at a time. It only depends on the seed and the frame number.
+static void ScriptInput(Instance* instance)
+{
+    long frame = instance->frame;
+    uint8_t bits = 0;
+    if (frame >= 30 && frame < 36) bits = 0x01;         // COIN
+    else if (frame >= 90 && frame < 96) bits = 0x04;    // 1P START
+    else if (frame >= 120)
+    {
+        if (instance->hold_frames == 0)
+        {
+            uint64_t r = NextRandom(&instance->rng);
+            instance->held = (uint8_t) (r & 0x70);      // 1P SHOOT, LEFT, RIGHT
+            instance->hold_frames = 8 + (int) ((r >> 8) & 31);
+        }
+        instance->hold_frames--;
+        bits = instance->held;
+    }
+    instance->machine->ports.input1 = 0b00001000 | bits;
+}
+
+static void RunSlice(Runner* runner, int task, Worker* worker)
+{
+    Group* group = &runner->groups[task];
+    Instance* instances = &runner->instances[group->first];
+    Machine* machines[LANES_8080];
+    int live = 0;
+    for (int i = 0; i < runner->slice; i++)
+    {
+        // Machines that halted or got to the target drop out of the group
+        live = 0;
+        for (int n = 0; n < group->count; n++)
+        {
+            if (instances[n].frame >= instances[n].target || instances[n].machine->halted) continue;
+            ScriptInput(&instances[n]);
+            instances[n].frame++;
+            machines[live++] = instances[n].machine;
+        }
+        if (live == 0) break;
+
+        if (group->lanes) RunMachineFramesInLanes(group->lanes, machines, live);
+        else RunMachineFrame(machines[0]);
+    }
+    worker->slices++;
+
+    for (int n = 0; n < group->count; n++)
+    {
+        if (instances[n].frame < instances[n].target && !instances[n].machine->halted)
+        {
+            PushTask(&worker->deque, task);
+            return;
+        }
+    }
+    atomic_fetch_sub_explicit(&runner->remaining, 1, memory_order_release);
+}
+
+// Own deque first, then the others from a random victim on; TASK_EMPTY once every
+// group is done
+static int FindTask(Runner* runner, Worker* worker)
+{
+    for (;;)
+    {
+        int task = TakeTask(&worker->deque);
+        if (task >= 0) return task;
+
+        int contended = 0;
+        int start = (int) (NextRandom(&worker->rng) % runner->threads);
+        for (int i = 0; i < runner->threads; i++)
+        {
+            int victim = (start + i) % runner->threads;
+            if (victim == worker->index) continue;
+            task = StealTask(&runner->workers[victim].deque);
+            if (task >= 0)
+            {
+                worker->steals++;
+                return task;
+            }
+            if (task == TASK_RETRY) contended = 1;
+        }
+
+        if (atomic_load_explicit(&runner->remaining, memory_order_acquire) == 0) return TASK_EMPTY;
+        if (!contended) sched_yield();
+    }
+}
+
+static void* WorkerThread(void* arg)
+{
+    Worker* worker = arg;
+    int task;
+    while ((task = FindTask(worker->runner, worker)) >= 0)
+        RunSlice(worker->runner, task, worker);
+    return NULL;
+}
+
+Runner* NewRunner(const RomSet* rom, Core core, int count, uint64_t seed, int lanes)
+{
+    if (count < 1 || lanes < 0 || lanes > LANES_8080)
+    {
+        printf("error: A runner needs at least one machine, and lane groups hold at most %d\n", LANES_8080);
+        return NULL;
+    }
+    Runner* runner = calloc(1, sizeof(Runner));
+    runner->instances = calloc(count, sizeof(Instance));
+    runner->count = count;
+    for (int i = 0; i < count; i++)
+    {
+        Instance* instance = &runner->instances[i];
+        instance->machine = NewMachine(rom, core);
+        instance->rng = seed ^ (0x9E3779B97F4A7C15ULL * (i + 1));
+        if (instance->rng == 0) instance->rng = 1;  // xorshift never leaves zero
+    }
+    int size = lanes ? lanes : 1;
+    runner->group_count = (count + size - 1) / size;
+    runner->groups = calloc(runner->group_count, sizeof(Group));
+    for (int i = 0; i < runner->group_count; i++)
+    {
+        Group* group = &runner->groups[i];
+        group->first = i * size;
+        group->count = count - group->first < size ? count - group->first : size;
+        if (lanes) group->lanes = calloc(1, sizeof(Lanes8080));
+    }
+    for (int i = 0; i < RUNNER_MAX_THREADS; i++)
+    {
+        Worker* worker = &runner->workers[i];
+        worker->runner = runner;
+        worker->index = i;
+        worker->rng = 0x2545F4914F6CDD1DULL * (i + 1);
+        InitDeque(&worker->deque, runner->group_count);
+    }
+    return runner;
+}
+
+void FreeRunner(Runner* runner)
+{
+    for (int i = 0; i < runner->count; i++)
+        FreeMachine(runner->instances[i].machine);
+    for (int i = 0; i < runner->group_count; i++)
+        free(runner->groups[i].lanes);
+    for (int i = 0; i < RUNNER_MAX_THREADS; i++)
+        free(runner->workers[i].deque.tasks);
+    free(runner->groups);
+    free(runner->instances);
+    free(runner);
+}
+
+double RunInstances(Runner* runner, long frames, int slice, int threads)
+{
+    if (threads < 1 || threads > RUNNER_MAX_THREADS || slice < 1)
+    {
+        printf("error: Runner needs 1-%d threads and a slice of at least one frame\n", RUNNER_MAX_THREADS);
+        return -1.0;
+    }
+    runner->slice = slice;
+    runner->threads = threads;
+
+    // Groups start spread round-robin; after that they stay with whoever ran them
+    // last unless someone idle steals them
+    int live = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        Worker* worker = &runner->workers[i];
+        atomic_store(&worker->deque.top, 0);
+        atomic_store(&worker->deque.bottom, 0);
+        worker->slices = 0;
+        worker->steals = 0;
+    }
+    for (int i = 0; i < runner->count; i++)
+        runner->instances[i].target = runner->instances[i].frame + frames;
+    for (int i = 0; i < runner->group_count; i++)
+    {
+        PushTask(&runner->workers[live % threads].deque, i);
+        live++;
+    }
+    atomic_store(&runner->remaining, live);
+
+    // A worker that doesn't start has its tasks stolen by the others, so the run still
+    // finishes, but not on the number of threads asked for
+    double start = Seconds();
+    pthread_t handles[RUNNER_MAX_THREADS];
+    int started = 1;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&handles[started], NULL, WorkerThread, &runner->workers[started]) != 0)
+        {
+            printf("error: Could not start worker thread %d\n", started);
+            break;
+        }
+    }
+    WorkerThread(&runner->workers[0]);
+    for (int i = 1; i < started; i++)
+        pthread_join(handles[i], NULL);
+    double seconds = Seconds() - start;
+    return started == threads ? seconds : -1.0;
+}
+
+uint32_t RunnerChecksum(Runner* runner)
+{
+    uint8_t snapshot[SNAPSHOT_SIZE];
+    uint32_t crc = 0;
+    for (int i = 0; i < runner->count; i++)
+    {
+        SaveSnapshot(snapshot, runner->instances[i].machine);
+        crc = Crc32(crc, snapshot, SNAPSHOT_SIZE);
+    }
+    return crc;
+}
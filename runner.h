@@ -0,0 +1,72 @@
+#ifndef INC_8080EMULATOR_RUNNER_H
+#define INC_8080EMULATOR_RUNNER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "machine.h"
+
+#define RUNNER_MAX_THREADS  64
+
+// One headless session: a machine and the seeded script that plays it
+typedef struct Instance {
+    Machine*    machine;
+    uint64_t    rng;            // xorshift state the input script draws from
+    uint8_t     held;           // player 1 bits held down by the script
+    int         hold_frames;    // until the script picks new bits
+    long        frame;          // frames run so far
+    long        target;         // frame to stop at in the current run
+} Instance;
+
+// Instances that run together: one at a time on their own cores, or all on lanes
+typedef struct Group {
+    int         first;          // instances[first .. first + count)
+    int         count;
+    Lanes8080*  lanes;          // NULL for the scalar runner
+} Group;
+
+// Work-stealing deque of group indices (Chase-Lev). The owning worker pushes and
+// takes at the bottom, other workers steal from the top.
+typedef struct Deque {
+    atomic_long     top;
+    atomic_long     bottom;
+    atomic_int*     tasks;
+    long            mask;       // capacity - 1, capacity is a power of two
+} Deque;
+
+typedef struct Worker {
+    struct Runner*  runner;
+    int             index;
+    Deque           deque;
+    uint64_t        rng;        // picks steal victims
+    long            slices;     // tasks run in the last run
+    long            steals;
+} Worker;
+
+// Many independent machines on one ROM, advanced in slices of frames by a pool of
+// workers. Each slice of a group is a task; a worker that runs dry steals from the others.
+typedef struct Runner {
+    Instance*       instances;
+    int             count;
+    Group*          groups;
+    int             group_count;
+    int             slice;          // frames per task
+    int             threads;
+    Worker          workers[RUNNER_MAX_THREADS];
+    atomic_int      remaining;      // groups not yet at their target
+} Runner;
+
+// count machines on rom; instance i's input script is seeded from seed and i. With lanes
+// (at most LANES_8080) the machines run that many at a time in lockstep on RunLanes8080,
+// with 0 each one runs on its own core. NULL if count or lanes is out of range.
+Runner* NewRunner(const RomSet* rom, Core core, int count, uint64_t seed, int lanes);
+void FreeRunner(Runner* runner);
+// Advances every instance by frames, slice frames per task, on threads workers
+// (the calling thread is one of them); returns the wall-clock seconds it took, or a
+// negative number if the arguments are out of range or not every worker thread started
+double RunInstances(Runner* runner, long frames, int slice, int threads);
+// CRC32 over every instance's snapshot; the same for any thread count or slice size
+uint32_t RunnerChecksum(Runner* runner);
+// Monotonic wall-clock time in seconds, for timing runs
+double Seconds(void);
+
+#endif //INC_8080EMULATOR_RUNNER_H
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <limits.h>
+
+#include "scheduler.h"
+
+void InitScheduler(Scheduler* scheduler)
+{
+    scheduler->now = 0;
+    scheduler->count = 0;
+}
+
+int ScheduleEvent(Scheduler* scheduler, uint64_t when, int id)
+{
+    if (scheduler->count == MAX_EVENTS)
+    {
+        printf("error: Too many scheduled events\n");
+        return 1;
+    }
+
+    // Insertion sort, the list only ever holds a handful of events
+    int i = scheduler->count++;
+    while (i > 0 && scheduler->events[i - 1].when > when)
+    {
+        scheduler->events[i] = scheduler->events[i - 1];
+        i--;
+    }
+    scheduler->events[i].when = when;
+    scheduler->events[i].id = id;
+    return 0;
+}
+
+int CyclesToNextEvent(const Scheduler* scheduler)
+{
+    if (scheduler->count == 0) return INT_MAX;
+    if (scheduler->events[0].when <= scheduler->now) return 0;
+
+    uint64_t cycles = scheduler->events[0].when - scheduler->now;
+    return cycles > INT_MAX ? INT_MAX : (int) cycles;
+}
+
+int PopDueEvent(Scheduler* scheduler, Event* event)
+{
+    if (scheduler->count == 0 || scheduler->events[0].when > scheduler->now) return 0;
+
+    *event = scheduler->events[0];
+    scheduler->count--;
+    for (int i = 0; i < scheduler->count; i++)
+        scheduler->events[i] = scheduler->events[i + 1];
+    return 1;
+}
@@ -0,0 +1,26 @@
+#ifndef INC_8080EMULATOR_SCHEDULER_H
+#define INC_8080EMULATOR_SCHEDULER_H
+
+#include <stdint.h>
+
+#define MAX_EVENTS 8
+
+typedef struct Event {
+    uint64_t    when;       // emulated cycle the event is due on
+    int         id;
+} Event;
+
+// Events keyed on emulated cycles, so timing never depends on the host clock
+typedef struct Scheduler {
+    uint64_t    now;                    // emulated cycles since reset
+    int         count;
+    Event       events[MAX_EVENTS];     // sorted, soonest first
+} Scheduler;
+
+void InitScheduler(Scheduler* scheduler);
+// Returns nonzero, and schedules nothing, when MAX_EVENTS events are already pending
+int ScheduleEvent(Scheduler* scheduler, uint64_t when, int id);
+int CyclesToNextEvent(const Scheduler* scheduler);
+int PopDueEvent(Scheduler* scheduler, Event* event);
+
+#endif //INC_8080EMULATOR_SCHEDULER_H
@@ -0,0 +1,70 @@
+#include <string.h>
+#include "screen.h"
+
+// 8 output pixels for every value of a byte, bit 0 first, built by the compiler so the
+// decoder needs no setup and can run on any thread
+#define EXPAND_BIT(v, bit)  (((v) >> (bit)) & 1 ? PIXEL_ON : PIXEL_OFF)
+#define EXPAND_1(v)     { EXPAND_BIT(v, 0), EXPAND_BIT(v, 1), EXPAND_BIT(v, 2), EXPAND_BIT(v, 3), \
+                          EXPAND_BIT(v, 4), EXPAND_BIT(v, 5), EXPAND_BIT(v, 6), EXPAND_BIT(v, 7) }
+#define EXPAND_4(v)     EXPAND_1(v), EXPAND_1(v + 1), EXPAND_1(v + 2), EXPAND_1(v + 3)
+#define EXPAND_16(v)    EXPAND_4(v), EXPAND_4(v + 4), EXPAND_4(v + 8), EXPAND_4(v + 12)
+#define EXPAND_64(v)    EXPAND_16(v), EXPAND_16(v + 16), EXPAND_16(v + 32), EXPAND_16(v + 48)
+
+static const uint32_t expand_byte[256][8] = {
+        EXPAND_64(0), EXPAND_64(64), EXPAND_64(128), EXPAND_64(192)
+};
+
+static uint64_t Transpose8x8(uint64_t x);
+
+// Bit transpose of an 8x8 matrix stored one row per byte: bit c of byte r
+// moves to bit r of byte c
+static uint64_t Transpose8x8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// Reference decoder: one bit test and one rotated store per pixel
+void DecodeScreenScalar(const uint8_t* video_memory, int start_y, int end_y, uint32_t* pixels, int pitch)
+{
+    for (int y = start_y; y < end_y; y++) {
+        for (int x = 0; x < 256; x++) {
+            int byte_offset = y * 32 + x / 8;
+            int bit_offset = x % 8;
+
+            uint32_t color = (video_memory[byte_offset] & (1 << bit_offset)) ? PIXEL_ON : PIXEL_OFF;
+            uint32_t* row = (uint32_t*) ((uint8_t*) pixels + (255 - x) * pitch);
+            row[y - start_y] = color;
+        }
+    }
+}
+
+// Same output as DecodeScreenScalar, 8x8 pixels at a time: the bytes at one x offset
+// of 8 consecutive lines are bit-transposed so each result byte holds 8 horizontally
+// adjacent output pixels, which come out of the lookup table as one 32 byte copy.
+// Output rows are filled left to right, one tile column at a time. The line count
+// must be a multiple of 8 (both screen halves are 112).
+void DecodeScreen(const uint8_t* video_memory, int start_y, int end_y, uint32_t* pixels, int pitch)
+{
+    for (int x_byte = 0; x_byte < 32; x_byte++) {
+        for (int y = start_y; y < end_y; y += 8) {
+            const uint8_t* column = &video_memory[y * 32 + x_byte];
+            uint64_t tile = 0;
+            for (int line = 0; line < 8; line++)
+                tile |= (uint64_t) column[line * 32] << (8 * line);
+            tile = Transpose8x8(tile);
+
+            for (int bit = 0; bit < 8; bit++) {
+                int x = x_byte * 8 + bit;
+                uint32_t* row = (uint32_t*) ((uint8_t*) pixels + (255 - x) * pitch);
+                memcpy(&row[y - start_y], expand_byte[(tile >> (8 * bit)) & 0xff], 8 * sizeof(uint32_t));
+            }
+        }
+    }
+}
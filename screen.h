@@ -0,0 +1,15 @@
+#ifndef INC_8080EMULATOR_SCREEN_H
+#define INC_8080EMULATOR_SCREEN_H
+
+#include <stdint.h>
+
+#define PIXEL_ON    0xFFFFFFFF
+#define PIXEL_OFF   0x00000000
+
+// Turn video memory lines [start_y, end_y) into rotated RGBA pixels; both give the same output.
+// Video memory line y (32 bytes, bit 0 first) becomes column y - start_y of the output,
+// pixel x of the line goes to output row 255 - x. pitch is in bytes.
+void DecodeScreen(const uint8_t* video_memory, int start_y, int end_y, uint32_t* pixels, int pitch);
+void DecodeScreenScalar(const uint8_t* video_memory, int start_y, int end_y, uint32_t* pixels, int pitch);
+
+#endif //INC_8080EMULATOR_SCREEN_H
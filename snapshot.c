@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include "snapshot.h"
+#include "8080block.h"
+
+static const char magic[8] = { '8', '0', '8', '0', 'S', 'N', 'A', 'P' };
+
+static uint8_t* Put16(uint8_t* p, uint16_t value);
+static uint8_t* Put32(uint8_t* p, uint32_t value);
+static uint8_t* Put64(uint8_t* p, uint64_t value);
+static uint16_t Get16(const uint8_t** p);
+static uint32_t Get32(const uint8_t** p);
+static uint64_t Get64(const uint8_t** p);
+
+static uint8_t* Put16(uint8_t* p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static uint8_t* Put32(uint8_t* p, uint32_t value)
+{
+    p = Put16(p, value & 0xffff);
+    return Put16(p, value >> 16);
+}
+
+static uint8_t* Put64(uint8_t* p, uint64_t value)
+{
+    p = Put32(p, value & 0xffffffff);
+    return Put32(p, value >> 32);
+}
+
+static uint16_t Get16(const uint8_t** p)
+{
+    uint16_t value = (*p)[0] | ((*p)[1] << 8);
+    *p += 2;
+    return value;
+}
+
+static uint32_t Get32(const uint8_t** p)
+{
+    uint32_t low = Get16(p);
+    return low | ((uint32_t) Get16(p) << 16);
+}
+
+static uint64_t Get64(const uint8_t** p)
+{
+    uint64_t low = Get32(p);
+    return low | ((uint64_t) Get32(p) << 32);
+}
+
+void SaveSnapshot(uint8_t* snapshot, Machine* machine)
+{
+    State8080* state = &machine->state;
+    const Ports* ports = &machine->ports;
+    const Scheduler* scheduler = &machine->scheduler;
+    Materialize8080Flags(state);
+
+    uint8_t* p = snapshot;
+    memcpy(p, magic, sizeof(magic));
+    p += sizeof(magic);
+    p = Put32(p, SNAPSHOT_VERSION);
+    p = Put32(p, machine->rom_crc);
+
+    *p++ = state->a;
+    *p++ = state->b;
+    *p++ = state->c;
+    *p++ = state->d;
+    *p++ = state->e;
+    *p++ = state->h;
+    *p++ = state->l;
+    *p++ = state->cc.psw & PSW_FLAGS;
+    *p++ = state->int_enable;
+    p = Put16(p, state->sp);
+    p = Put16(p, state->pc);
+    p = Put64(p, state->instructions);
+
+    *p++ = ports->input0;
+    *p++ = ports->input1;
+    *p++ = ports->input2;
+    *p++ = ports->output2;
+    *p++ = ports->output3;
+    *p++ = ports->output5;
+    *p++ = ports->output6;
+    *p++ = ports->shift_amount;
+    p = Put16(p, ports->shift_register);
+
+    p = Put64(p, scheduler->now);
+    *p++ = (uint8_t) scheduler->count;
+    for (int i = 0; i < MAX_EVENTS; i++)
+    {
+        p = Put64(p, scheduler->events[i].when);
+        *p++ = (uint8_t) scheduler->events[i].id;
+    }
+    *p++ = machine->pending_interrupt;
+
+    for (int page = 0; page < SNAPSHOT_RAM_SIZE / PAGE_SIZE; page++)
+        memcpy(p + page * PAGE_SIZE, machine->map.read[(SNAPSHOT_RAM_START >> 8) + page], PAGE_SIZE);
+}
+
+int LoadSnapshot(const uint8_t* snapshot, Machine* machine)
+{
+    State8080* state = &machine->state;
+    Ports* ports = &machine->ports;
+    Scheduler* scheduler = &machine->scheduler;
+    const uint8_t* p = snapshot;
+    if (memcmp(p, magic, sizeof(magic)) != 0)
+    {
+        printf("error: Not a snapshot\n");
+        return 1;
+    }
+    p += sizeof(magic);
+    uint32_t version = Get32(&p);
+    if (version != SNAPSHOT_VERSION)
+    {
+        printf("error: Snapshot version %u, this build reads version %d\n", (unsigned) version, SNAPSHOT_VERSION);
+        return 1;
+    }
+    uint32_t crc = Get32(&p);
+    if (crc != machine->rom_crc)
+    {
+        printf("error: Snapshot was taken with ROM %08x, running %08x\n", (unsigned) crc, (unsigned) machine->rom_crc);
+        return 1;
+    }
+    // Checked up front so a bad snapshot leaves the machine untouched
+    if (p[SNAPSHOT_CPU_SIZE + SNAPSHOT_PORTS_SIZE + 8] > MAX_EVENTS)
+    {
+        printf("error: Snapshot is corrupt\n");
+        return 1;
+    }
+
+    state->a = *p++;
+    state->b = *p++;
+    state->c = *p++;
+    state->d = *p++;
+    state->e = *p++;
+    state->h = *p++;
+    state->l = *p++;
+    state->cc.psw = *p++ & PSW_FLAGS;
+    state->cc.lazy_pending = 0;
+    state->int_enable = *p++;
+    state->sp = Get16(&p);
+    state->pc = Get16(&p);
+    state->instructions = Get64(&p);
+
+    ports->input0 = *p++;
+    ports->input1 = *p++;
+    ports->input2 = *p++;
+    ports->output2 = *p++;
+    ports->output3 = *p++;
+    ports->output5 = *p++;
+    ports->output6 = *p++;
+    ports->shift_amount = *p++;
+    ports->shift_register = Get16(&p);
+
+    scheduler->now = Get64(&p);
+    scheduler->count = *p++;
+    for (int i = 0; i < MAX_EVENTS; i++)
+    {
+        scheduler->events[i].when = Get64(&p);
+        scheduler->events[i].id = *p++;
+    }
+    machine->pending_interrupt = *p++;
+
+    // Straight into the pages (unshared from any forks), so mark what the write handlers would have
+    for (int page = 0; page < SNAPSHOT_RAM_SIZE / PAGE_SIZE; page++)
+        memcpy(OwnRamPage(machine, (SNAPSHOT_RAM_START >> 8) + page), p + page * PAGE_SIZE, PAGE_SIZE);
+    if (state->dirty_lines) memset(state->dirty_lines + (SNAPSHOT_RAM_START >> 5), 1, SNAPSHOT_RAM_SIZE >> 5);
+    if (state->blocks) FlushBlockCache8080(state->blocks);
+    return 0;
+}
+
+int WriteSnapshotFile(const char* path, const uint8_t* snapshot)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        printf("error: Couldn't create %s\n", path);
+        return 1;
+    }
+    size_t written = fwrite(snapshot, 1, SNAPSHOT_SIZE, f);
+    if (fclose(f) != 0 || written != SNAPSHOT_SIZE)
+    {
+        printf("error: Couldn't write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int ReadSnapshotFile(const char* path, uint8_t* snapshot)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("error: Couldn't open %s\n", path);
+        return 1;
+    }
+    size_t read = fread(snapshot, 1, SNAPSHOT_SIZE, f);
+    int extra = fgetc(f) != EOF;
+    fclose(f);
+    if (read != SNAPSHOT_SIZE || extra)
+    {
+        printf("error: %s is not a %d byte snapshot\n", path, SNAPSHOT_SIZE);
+        return 1;
+    }
+    return 0;
+}
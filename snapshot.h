@@ -0,0 +1,29 @@
+#ifndef INC_8080EMULATOR_SNAPSHOT_H
+#define INC_8080EMULATOR_SNAPSHOT_H
+
+#include <stdint.h>
+#include "machine.h"
+
+// Snapshot format, all fields little-endian:
+//   "8080SNAP", version, CRC32 of the ROM it was taken with,
+//   CPU registers, ports, scheduler, pending interrupt, then RAM and VRAM (0x2000-0x3FFF).
+// The ROM itself is not stored. Bump the version whenever the layout changes.
+#define SNAPSHOT_VERSION        1
+#define SNAPSHOT_RAM_START      0x2000
+#define SNAPSHOT_RAM_SIZE       0x2000
+#define SNAPSHOT_HEADER_SIZE    16
+#define SNAPSHOT_CPU_SIZE       21
+#define SNAPSHOT_PORTS_SIZE     10
+#define SNAPSHOT_EVENTS_SIZE    (9 + MAX_EVENTS * 9 + 1)    // scheduler and pending interrupt
+#define SNAPSHOT_SIZE           (SNAPSHOT_HEADER_SIZE + SNAPSHOT_CPU_SIZE + SNAPSHOT_PORTS_SIZE + \
+                                 SNAPSHOT_EVENTS_SIZE + SNAPSHOT_RAM_SIZE)
+
+// Fills snapshot, which must hold SNAPSHOT_SIZE bytes. Cheap enough to call every frame.
+void SaveSnapshot(uint8_t* snapshot, Machine* machine);
+// Restores a snapshot taken with the same ROM; returns nonzero and changes nothing if it can't.
+// Video lines are marked dirty and the block cache is flushed, since memory changes underneath them.
+int LoadSnapshot(const uint8_t* snapshot, Machine* machine);
+int WriteSnapshotFile(const char* path, const uint8_t* snapshot);
+int ReadSnapshotFile(const char* path, uint8_t* snapshot);
+
+#endif //INC_8080EMULATOR_SNAPSHOT_H
@@ -3,136 +3,210 @@
 
 #include "sound.h"
 
-void PlaySounds(Ports* ports, int port, uint8_t old_bits)
+#define SOUND_UFO   0   // the only looping sound
+#define SOUND_LATENCY       2048    // samples of slack given to the first event after a resync
+#define SOUND_MAX_LEAD      22050   // events further ahead than this (in samples) resync the clock
+#define SOUND_MAX_LAG       4410    // ... and events this late
+
+
+static int LoadSample(Sample* sample, const char* path, const SDL_AudioSpec* device_spec);
+static void MixVoices(Mixer* m, Sint16* out, int count);
+static void StartEvent(Mixer* m, const SoundEvent* event);
+static void PushSoundEvent(Mixer* mixer, uint64_t when, int sound, int on);
+static void MixAudio(void* userdata, Uint8* stream, int len);
+
+// Decodes every sound once, converts it to the device format, and starts the mixer.
+// Returns 0 on success; a missing sound file only leaves that sound silent.
+int InitSound(Mixer* mixer, const char* directory)
 {
-    static SDL_AudioSpec wav_spec;
-    static Uint32 wav_length;
-    static Uint8 *wav_buffer;
-    static Uint8 *ufo_buffer = NULL;
-    static int is_playing = 0;
-    static SDL_AudioDeviceID device_id = 0;
-
-    // Init
-    if (device_id == 0) {
-        wav_spec.freq = 44100;
-        wav_spec.format = AUDIO_S16SYS;
-        wav_spec.channels = 1;           // Mono
-        wav_spec.samples = 4096;         // Buffer size
-        wav_spec.callback = NULL;
-
-        device_id = SDL_OpenAudioDevice(NULL, 0, &wav_spec, NULL, 0);
-        if (device_id == 0) {
-            printf("SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
-            SDL_Quit();
-            return;
-        }
-        SDL_LoadWAV("../Rom/Sounds/0.wav", &wav_spec, &ufo_buffer, &wav_length);
+    SDL_AudioSpec want;
+    SDL_memset(&want, 0, sizeof(want));
+    want.freq = 44100;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;           // Mono
+    want.samples = 1024;         // Buffer size, about 23 ms
+    want.callback = MixAudio;
+    want.userdata = mixer;
+
+    SDL_AudioSpec have;
+    mixer->device_id = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (mixer->device_id == 0) {
+        printf("SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
+        return 1;
     }
 
-    if (port == 3)
+    for (int i = 0; i < SOUND_COUNT; i++)
     {
-        uint8_t bits = ports->output3;
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%d.wav", directory, i);
+        if (LoadSample(&mixer->samples[i], path, &have) != 0)
+            printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
+        mixer->position[i] = -1;
+    }
+    mixer->freq = have.freq;
+    mixer->synced = 0;
+    atomic_init(&mixer->head, 0);
+    atomic_init(&mixer->tail, 0);
+    atomic_init(&mixer->dropped, 0);
 
-        // UFO sound - 0.wav repeatedly
-        if (bits & 0x1)
-        {
-            SDL_QueueAudio(device_id, ufo_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0);
-            is_playing = 1;
-        }
-            // Stop UFO sound when the bit is cleared
-        else if (is_playing && ((bits & 0x1) == 0))
-        {
-            SDL_ClearQueuedAudio(device_id);  // Clear the queue
-            is_playing = 0;
-        }
+    SDL_PauseAudioDevice(mixer->device_id, 0);
+    return 0;
+}
 
-        // Shot sound - 1.wav
-        if ((bits & 0x02) && !(old_bits & 0x02))
-        {
-            if (SDL_LoadWAV("../Rom/Sounds/1.wav", &wav_spec, &wav_buffer, &wav_length) == NULL) {
-                printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
-                return;
-            }
-            SDL_QueueAudio(device_id, wav_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0); // Unpause to start playback
-        }
+void CloseSound(Mixer* mixer)
+{
+    if (mixer->device_id == 0) return;
+    SDL_CloseAudioDevice(mixer->device_id);
+    mixer->device_id = 0;
+    for (int i = 0; i < SOUND_COUNT; i++)
+    {
+        SDL_free(mixer->samples[i].data);
+        mixer->samples[i].data = NULL;
+        mixer->samples[i].length = 0;
+    }
+}
 
-        // Flash (player die) - 2.wav
-        if ((bits & 0x04) && !(old_bits & 0x04)) {
-            if (SDL_LoadWAV("../Rom/Sounds/2.wav", &wav_spec, &wav_buffer, &wav_length) == NULL) {
-                printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
-                return;
-            }
-            SDL_QueueAudio(device_id, wav_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0); // Unpause to start playback
-        }
+static int LoadSample(Sample* sample, const char* path, const SDL_AudioSpec* device_spec)
+{
+    SDL_AudioSpec wav_spec;
+    Uint8* wav_buffer;
+    Uint32 wav_length;
+    sample->data = NULL;
+    sample->length = 0;
+    if (SDL_LoadWAV(path, &wav_spec, &wav_buffer, &wav_length) == NULL) return 1;
 
-        // Invader die - 3.wav
-        if ((bits & 0x08) && !(old_bits & 0x08)) {
-            if (SDL_LoadWAV("../Rom/Sounds/3.wav", &wav_spec, &wav_buffer, &wav_length) == NULL) {
-                printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
-                return;
-            }
-            SDL_QueueAudio(device_id, wav_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0); // Unpause to start playback
-        }
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, wav_spec.format, wav_spec.channels, wav_spec.freq,
+                          device_spec->format, device_spec->channels, device_spec->freq) < 0) {
+        SDL_FreeWAV(wav_buffer);
+        return 1;
+    }
+    cvt.len = wav_length;
+    cvt.buf = SDL_malloc(wav_length * cvt.len_mult);
+    if (cvt.buf == NULL) {
+        SDL_FreeWAV(wav_buffer);
+        return 1;
+    }
+    SDL_memcpy(cvt.buf, wav_buffer, wav_length);
+    SDL_FreeWAV(wav_buffer);
+    if (cvt.needed && SDL_ConvertAudio(&cvt) != 0) {
+        SDL_free(cvt.buf);
+        return 1;
     }
-        // Port 5
-    else
-    {
-        uint8_t bits = ports->output5;
 
-        // Fleet movement 1 - 4.wav
-        if ((bits & 0x02) && !(old_bits & 0x02))
-        {
-            if (SDL_LoadWAV("../Rom/Sounds/4.wav", &wav_spec, &wav_buffer, &wav_length) == NULL) {
-                printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
-                return;
-            }
-            SDL_QueueAudio(device_id, wav_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0); // Unpause to start playback
-        }
+    sample->data = (Sint16*) cvt.buf;
+    sample->length = (cvt.needed ? cvt.len_cvt : cvt.len) / (int) sizeof(Sint16);
+    return 0;
+}
 
-        // Fleet movement 2 - 5.wav
-        if ((bits & 0x02) && !(old_bits & 0x02))
+// Adds up every playing voice into count samples. The UFO voice wraps around until
+// an event switches it off.
+static void MixVoices(Mixer* m, Sint16* out, int count)
+{
+    for (int n = 0; n < count; n++)
+    {
+        int mix = 0;
+        for (int i = 0; i < SOUND_COUNT; i++)
         {
-            if (SDL_LoadWAV("../Rom/Sounds/5.wav", &wav_spec, &wav_buffer, &wav_length) == NULL) {
-                printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
-                return;
-            }
-            SDL_QueueAudio(device_id, wav_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0); // Unpause to start playback
-        }
+            const Sample* sample = &m->samples[i];
+            int position = m->position[i];
+            if (position < 0 || sample->length == 0) continue;
 
-        // Fleet movement 3 - 6.wav
-        if ((bits & 0x04) && !(old_bits & 0x04)) {
-            if (SDL_LoadWAV("../Rom/Sounds/6.wav", &wav_spec, &wav_buffer, &wav_length) == NULL) {
-                printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
-                return;
-            }
-            SDL_QueueAudio(device_id, wav_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0); // Unpause to start playback
+            mix += sample->data[position++];
+            if (position == sample->length) position = (i == SOUND_UFO) ? 0 : -1;
+            m->position[i] = position;
         }
+        if (mix > 32767) mix = 32767;
+        if (mix < -32768) mix = -32768;
+        out[n] = (Sint16) mix;
+    }
+}
+
+static void StartEvent(Mixer* m, const SoundEvent* event)
+{
+    if (event->sound != SOUND_UFO) m->position[event->sound] = 0;
+    else if (!event->on) m->position[SOUND_UFO] = -1;
+    else if (m->position[SOUND_UFO] < 0) m->position[SOUND_UFO] = 0;
+}
+
+// Audio thread: plays the buffer that starts at emulated time mix_sample, starting
+// each queued event on the sample its cycle stamp falls on. When an event is too far
+// from that clock (first sound, pauses, unthrottled runs) the clock jumps so the event
+// plays SOUND_LATENCY samples from now.
+static void MixAudio(void* userdata, Uint8* stream, int len)
+{
+    Mixer* m = userdata;
+    Sint16* out = (Sint16*) stream;
+    int count = len / (int) sizeof(Sint16);
+    int done = 0;
 
-        // Fleet movement 4 - 7.wav
-        if ((bits & 0x08) && !(old_bits & 0x08)) {
-            if (SDL_LoadWAV("../Rom/Sounds/7.wav", &wav_spec, &wav_buffer, &wav_length) == NULL) {
-                printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
-                return;
-            }
-            SDL_QueueAudio(device_id, wav_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0); // Unpause to start playback
+    unsigned int tail = atomic_load_explicit(&m->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&m->head, memory_order_acquire);
+    while (tail != head)
+    {
+        const SoundEvent* event = &m->events[tail & (SOUND_EVENTS - 1)];
+        int64_t at = (int64_t) (event->when * m->freq / SOUND_CPU_HZ);
+        if (!m->synced || at > m->mix_sample + SOUND_MAX_LEAD || at < m->mix_sample - SOUND_MAX_LAG) {
+            m->mix_sample = at - SOUND_LATENCY - done;
+            m->synced = 1;
         }
 
-        // UFO Hit - 8.wav
-        if ((bits & 0x10) && !(old_bits & 0x10)) {
-            if (SDL_LoadWAV("../Rom/Sounds/8.wav", &wav_spec, &wav_buffer, &wav_length) == NULL) {
-                printf("SDL_LoadWAV failed: %s\n", SDL_GetError());
-                return;
-            }
-            SDL_QueueAudio(device_id, wav_buffer, wav_length);
-            SDL_PauseAudioDevice(device_id, 0); // Unpause to start playback
+        int64_t offset = at - m->mix_sample;
+        if (offset >= count) break;     // belongs to a later buffer
+        if (offset > done) {
+            MixVoices(m, out + done, (int) offset - done);
+            done = (int) offset;
         }
+        StartEvent(m, event);
+        tail++;
+    }
+    atomic_store_explicit(&m->tail, tail, memory_order_release);
+
+    MixVoices(m, out + done, count - done);
+    m->mix_sample += count;
+}
+
+// Emulation thread: queues an event, or drops it when the callback has fallen a full
+// ring behind. Never blocks.
+static void PushSoundEvent(Mixer* mixer, uint64_t when, int sound, int on)
+{
+    unsigned int head = atomic_load_explicit(&mixer->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&mixer->tail, memory_order_acquire);
+    if (head - tail == SOUND_EVENTS) {
+        atomic_fetch_add_explicit(&mixer->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    SoundEvent* event = &mixer->events[head & (SOUND_EVENTS - 1)];
+    event->when = when;
+    event->sound = (uint8_t) sound;
+    event->on = (uint8_t) on;
+    atomic_store_explicit(&mixer->head, head + 1, memory_order_release);
+}
+
+// Called after OUT 3 or OUT 5 with the port's previous and new bits and the emulated
+// cycle of the OUT. Sounds start on a rising bit, the UFO loops while its bit is held.
+void PlaySounds(Mixer* mixer, int port, uint8_t old_bits, uint8_t bits, uint64_t when)
+{
+    if (port == 3)
+    {
+        uint8_t rising = bits & ~old_bits;
+        uint8_t falling = old_bits & ~bits;
+
+        if (rising & 0x01) PushSoundEvent(mixer, when, 0, 1);          // UFO - 0.wav repeatedly
+        if (falling & 0x01) PushSoundEvent(mixer, when, 0, 0);
+        if (rising & 0x02) PushSoundEvent(mixer, when, 1, 1);          // Shot - 1.wav
+        if (rising & 0x04) PushSoundEvent(mixer, when, 2, 1);          // Flash (player die) - 2.wav
+        if (rising & 0x08) PushSoundEvent(mixer, when, 3, 1);          // Invader die - 3.wav
+    }
+        // Port 5
+    else
+    {
+        uint8_t rising = bits & ~old_bits;
+
+        if (rising & 0x01) PushSoundEvent(mixer, when, 4, 1);          // Fleet movement 1 - 4.wav
+        if (rising & 0x02) PushSoundEvent(mixer, when, 5, 1);          // Fleet movement 2 - 5.wav
+        if (rising & 0x04) PushSoundEvent(mixer, when, 6, 1);          // Fleet movement 3 - 6.wav
+        if (rising & 0x08) PushSoundEvent(mixer, when, 7, 1);          // Fleet movement 4 - 7.wav
+        if (rising & 0x10) PushSoundEvent(mixer, when, 8, 1);          // UFO Hit - 8.wav
     }
 }
@@ -1,8 +1,45 @@
 #ifndef INC_8080EMULATOR_SOUND_H
 #define INC_8080EMULATOR_SOUND_H
 
-#include "ports.h"
+#include <stdint.h>
+#include <stdatomic.h>
+#include <SDL2/SDL.h>
 
-void PlaySounds(Ports* ports, int port, uint8_t old_bits);
+#define SOUND_COUNT 9           // Rom/Sounds/0.wav .. 8.wav
+#define SOUND_CPU_HZ 2000000    // emulated cycles per second, for event time stamps
+#define SOUND_EVENTS        256     // ring size, a power of two
+
+// One decoded sound effect, in the device format (signed 16 bit mono)
+typedef struct Sample {
+    Sint16*     data;
+    int         length;     // in samples
+} Sample;
+
+// Start a sound, or switch the UFO loop on or off, at an emulated cycle
+typedef struct SoundEvent {
+    uint64_t    when;
+    uint8_t     sound;
+    uint8_t     on;         // only 0 for SOUND_UFO
+} SoundEvent;
+
+// The emulation thread is the only writer of head and the audio callback the only
+// writer of tail, so the ring needs no lock. The callback owns the voices.
+typedef struct Mixer {
+    SDL_AudioDeviceID   device_id;
+    int                 freq;
+    Sample              samples[SOUND_COUNT];
+    SoundEvent          events[SOUND_EVENTS];
+    atomic_uint         head;                   // next slot the emulation thread fills
+    atomic_uint         tail;                   // next event the callback plays
+    atomic_uint         dropped;                // events lost to a full ring
+    int64_t             mix_sample;             // emulated time of the next output sample, in samples
+    int                 synced;
+    int                 position[SOUND_COUNT];  // next sample of each voice, -1 when silent
+} Mixer;
+
+// Decodes the sounds in directory and starts mixing; returns nonzero without an audio device
+int InitSound(Mixer* mixer, const char* directory);
+void CloseSound(Mixer* mixer);
+void PlaySounds(Mixer* mixer, int port, uint8_t old_bits, uint8_t bits, uint64_t when);
 
 #endif //INC_8080EMULATOR_SOUND_H
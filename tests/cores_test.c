@@ -0,0 +1,294 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "machine.h"
+#include "profiler.h"
+#include "romset.h"
+#include "snapshot.h"
+
+// Runs a generated program on every core and on the lane core and checks that they all
+// end up in the same state. The program is random straight-line code with forward
+// branches, RAM and VRAM traffic, port I/O, interrupt handlers and a routine in RAM
+// that keeps rewriting itself, so slices end mid-block and blocks get invalidated, the
+// routine's own block while it runs. PROFILE builds also check that the blocks core
+// profiles the same instructions and cycles as the batch core.
+
+#define FRAMES      300
+#define MACHINES    4
+#define LOOP_START  0x0200
+#define LOOP_END    0x1f00
+#define RAM_ROUTINE 0x2200
+#define XCHG_AT     0x0030  // a lone XCHG for the cycle check, never reached by the program
+
+static uint8_t image[ROM_SIZE];
+static int here;
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t Random(uint32_t range)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t) (rng >> 32) % range;
+}
+
+static void Emit1(uint8_t byte)
+{
+    image[here++] = byte;
+}
+
+static void Emit2(uint8_t op, uint8_t data)
+{
+    Emit1(op);
+    Emit1(data);
+}
+
+static void Emit3(uint8_t op, uint16_t address)
+{
+    Emit1(op);
+    Emit1(address & 0xff);
+    Emit1(address >> 8);
+}
+
+static void Emit(int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    for (int i = 0; i < count; i++)
+        Emit1((uint8_t) va_arg(args, int));
+    va_end(args);
+}
+
+// A register other than M
+static int Register(void)
+{
+    int r = (int) Random(7);
+    return r == 6 ? 7 : r;
+}
+
+// One instruction that falls through and leaves SP alone
+static void EmitSimple(void)
+{
+    switch (Random(12)) {
+        case 0: Emit1(0x80 | Random(8) << 3 | Register()); break;       // ALU r
+        case 1: Emit1(0x40 | Register() << 3 | Register()); break;      // MOV r,r
+        case 2: Emit2(0x06 | Register() << 3, Random(256)); break;      // MVI r
+        case 3: Emit1(0x04 | Register() << 3 | Random(2)); break;       // INR/DCR r
+        case 4: Emit1(0x07 | Random(8) << 3); break;                    // rotates, DAA, CMA, STC, CMC
+        case 5: Emit1(0x03 | Random(2) << 3 | Random(2) << 4); break;   // INX/DCX B/D
+        case 6: Emit1(0x09 | Random(2) << 4); break;                    // DAD B/D
+        case 7: Emit2(0xc6 | Random(8) << 3, Random(256)); break;       // ALU immediate
+        case 8: Emit1(0xeb); break;                                     // XCHG
+        case 9:
+            // M somewhere in video RAM
+            Emit2(0x26, 0x24 + Random(0x1c));
+            switch (Random(5)) {
+                case 0: Emit1(0x70 | Register()); break;                // MOV M,r
+                case 1: Emit1(0x46 | Register() << 3); break;           // MOV r,M
+                case 2: Emit1(0x86 | Random(8) << 3); break;            // ALU M
+                case 3: Emit1(0x34 | Random(2)); break;                 // INR/DCR M
+                default: Emit2(0x36, Random(256)); break;               // MVI M
+            }
+            break;
+        case 10: Emit3(Random(2) ? 0x32 : 0x3a, 0x2400 + Random(0x1c00)); break;  // STA/LDA
+        default: Emit1(0xc5 | Random(4) << 4); Emit1(0xc1 | Random(4) << 4); break; // PUSH, POP
+    }
+}
+
+static void BuildRom(void)
+{
+    memset(image, 0, sizeof(image));
+    here = 0x0000;
+    Emit3(0xc3, 0x0040);
+    here = 0x0008;
+    Emit3(0xc3, 0x0100);
+    here = 0x0010;
+    Emit3(0xc3, 0x0140);
+    here = XCHG_AT;
+    Emit1(0xeb);
+
+    // Stack, then MVI A,0 / ADD B / STA over the MVI's immediate / RET in RAM, then
+    // interrupts on
+    here = 0x0040;
+    Emit3(0x31, 0x2400);
+    Emit3(0x21, RAM_ROUTINE);
+    const uint8_t routine[] = { 0x3e, 0x00, 0x80, 0x32, (RAM_ROUTINE + 1) & 0xff, RAM_ROUTINE >> 8, 0xc9 };
+    for (int i = 0; i < (int) sizeof(routine); i++)
+    {
+        Emit2(0x36, routine[i]);
+        Emit1(0x23);
+    }
+    Emit1(0xfb);
+    Emit3(0xc3, LOOP_START);
+
+    // RST 1: bump a counter in work RAM
+    here = 0x0100;
+    Emit(12, 0xf5, 0xe5, 0x21, 0x00, 0x21, 0x34, 0x3a, 0x01, 0x21, 0x86, 0x32, 0x01);
+    Emit(5, 0x21, 0xe1, 0xf1, 0xfb, 0xc9);
+    // RST 2: fold the input into work RAM and drive the shift register
+    here = 0x0140;
+    Emit(12, 0xf5, 0xc5, 0xd5, 0xe5, 0xdb, 0x01, 0x47, 0x3a, 0x02, 0x21, 0xa8, 0x07);
+    Emit(12, 0x32, 0x02, 0x21, 0xd3, 0x04, 0xdb, 0x03, 0x32, 0x03, 0x21, 0xe1, 0xd1);
+    Emit(4, 0xc1, 0xf1, 0xfb, 0xc9);
+
+    here = LOOP_START;
+    while (here < LOOP_END)
+    {
+        switch (Random(16)) {
+            case 0:
+            {
+                // Jcc over a few instructions
+                int jump = here;
+                Emit3(0xc2 | Random(8) << 3, 0);
+                for (int n = 1 + Random(3); n > 0; n--)
+                    EmitSimple();
+                image[jump + 1] = here & 0xff;
+                image[jump + 2] = here >> 8;
+                break;
+            }
+            case 1:
+                // Rewrite the immediate of the RAM routine, then call it
+                Emit3(0x32, RAM_ROUTINE + 1);
+                Emit3(0xcd, RAM_ROUTINE);
+                break;
+            case 2: Emit2(0xdb, 1 + Random(3)); break;          // IN 1-3
+            case 3: Emit2(0xd3, 2 + Random(5)); break;          // OUT 2-6
+            case 4: Emit1(Random(4) ? 0xfb : 0xf3); break;      // EI, sometimes DI
+            default: EmitSimple(); break;
+        }
+    }
+    Emit1(0xfb);
+    Emit3(0xc3, LOOP_START);
+}
+
+static uint32_t StateCrc(Machine* machine)
+{
+    uint8_t snapshot[SNAPSHOT_SIZE];
+    SaveSnapshot(snapshot, machine);
+    return Crc32(0, snapshot, SNAPSHOT_SIZE);
+}
+
+// Different input for every machine, changing every few frames
+static void SetInput(Machine* machine, int index, int frame)
+{
+    machine->ports.input1 = 0x08 | (uint8_t) (((frame / 7) * 37 + index * 101) & 0x77);
+    machine->ports.input2 = (uint8_t) ((frame / 11) * 13 + index);
+}
+
+// XCHG takes 4 states on the 8080; runs it once on each core entry point that can stop
+// after one instruction. Returns 1 if any of them counts something else.
+static int CheckXchgCycles(const RomSet* rom)
+{
+    Machine* machine = NewMachine(rom, CORE_BATCH);
+    State8080* state = &machine->state;
+    Exit8080 reason;
+    int cycles[3];
+    state->pc = XCHG_AT;
+    cycles[0] = Emulate8080Op(state);
+    state->pc = XCHG_AT;
+    cycles[1] = Emulate8080OpThreaded(state);
+    state->pc = XCHG_AT;
+    cycles[2] = Run8080(state, 1, &reason);
+    FreeMachine(machine);
+
+    int failed = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        if (cycles[i] == 4) continue;
+        printf("error: XCHG took %d cycles on entry point %d, not 4\n", cycles[i], i);
+        failed = 1;
+    }
+    return failed;
+}
+
+#ifdef PROFILE
+// Profiles machine 0 on the batch and on the blocks core; returns 1 if they differ
+static int CheckBlockProfile(const RomSet* rom)
+{
+    Profile8080* profiles[2];
+    const Core cores[2] = { CORE_BATCH, CORE_BLOCKS };
+    for (int i = 0; i < 2; i++)
+    {
+        Machine* machine = NewMachine(rom, cores[i]);
+        profiles[i] = NewProfile8080();
+        machine->state.profile = profiles[i];
+        for (int frame = 0; frame < FRAMES; frame++)
+        {
+            SetInput(machine, 0, frame);
+            RunMachineFrame(machine);
+        }
+        machine->state.profile = NULL;
+        FreeMachine(machine);
+    }
+    int failed = memcmp(profiles[0], profiles[1], sizeof(Profile8080)) != 0;
+    if (failed) printf("error: blocks core profile differs from the batch core's\n");
+    FreeProfile8080(profiles[0]);
+    FreeProfile8080(profiles[1]);
+    return failed;
+}
+#endif
+
+int main(void)
+{
+    BuildRom();
+    RomSet rom = { .name = "generated" };
+    for (int page = 0; page < ROM_PAGES; page++)
+        rom.page[page] = &image[page * 256];
+    rom.crc32 = Crc32(0, image, ROM_SIZE);
+
+    static const char* names[] = { "batch", "switch", "threaded", "blocks" };
+    uint32_t expected[MACHINES];
+    int failures = 0;
+    for (int core = CORE_BATCH; core <= CORE_BLOCKS; core++)
+    {
+        for (int i = 0; i < MACHINES; i++)
+        {
+            Machine* machine = NewMachine(&rom, (Core) core);
+            for (int frame = 0; frame < FRAMES; frame++)
+            {
+                SetInput(machine, i, frame);
+                RunMachineFrame(machine);
+            }
+            uint32_t crc = StateCrc(machine);
+            if (core == CORE_BATCH) expected[i] = crc;
+            else if (crc != expected[i])
+            {
+                printf("error: %s core ended machine %d in %08x, batch in %08x\n", names[core], i,
+                       (unsigned) crc, (unsigned) expected[i]);
+                failures++;
+            }
+            FreeMachine(machine);
+        }
+    }
+
+    static Lanes8080 lanes;
+    Machine* machines[MACHINES];
+    for (int i = 0; i < MACHINES; i++)
+        machines[i] = NewMachine(&rom, CORE_BATCH);
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+        for (int i = 0; i < MACHINES; i++)
+            SetInput(machines[i], i, frame);
+        RunMachineFramesInLanes(&lanes, machines, MACHINES);
+    }
+    for (int i = 0; i < MACHINES; i++)
+    {
+        uint32_t crc = StateCrc(machines[i]);
+        if (crc != expected[i])
+        {
+            printf("error: Lane core ended machine %d in %08x, batch in %08x\n", i,
+                   (unsigned) crc, (unsigned) expected[i]);
+            failures++;
+        }
+        FreeMachine(machines[i]);
+    }
+
+    failures += CheckXchgCycles(&rom);
+#ifdef PROFILE
+    failures += CheckBlockProfile(&rom);
+#endif
+
+    if (failures == 0) printf("All cores agree after %d frames on %d machines\n", FRAMES, MACHINES);
+    return failures != 0;
+}